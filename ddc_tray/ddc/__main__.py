@@ -1,13 +1,137 @@
-from ddc_tray.ddc.ddcutil_cffi import DDC
-print('MAIN')
+import time
+START = time.perf_counter()
+import sys
+import argparse
+from concurrent.futures import ThreadPoolExecutor
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, DDCError, DDCRC_ARG
+from ddc_tray.ddc.client import DaemonClient, RemoteDDC
 
-ddc = DDC()
-ddc.get_monitors()
-for mon in ddc.monitors:
-    print(mon)
+# fallback for dump when a monitor reports no capabilities
+DUMP_CODES = [0x10, 0x12, 0x16, 0x18, 0x1a, 0x60, 0x62, 0xd6]
+# continuous features, set checks a value above the usual maximum of 100 against
+# the one the monitor reports, values up to 100 are written without a read
+CONTINUOUS = {0x10, 0x12, 0x16, 0x18, 0x1a, 0x62}
+USUAL_MAX = 100
+FEATURE_NAMES = ', '.join(v.name.lower().replace('_', '-') for v in DDC_Interface.VCP)
+
+def parse_code(text: str) -> int:
+    '''a feature name like contrast or input-source, or a code like 0x12'''
+    try:
+        return DDC_Interface.VCP[text.upper().replace('-', '_')].value
+    except KeyError:
+        pass
+    try:
+        code = int(text, 0)
+    except ValueError:
+        code = -1
+    if not 0 <= code <= 0xff:
+        raise argparse.ArgumentTypeError(f'{text!r} is neither a VCP code nor one of {FEATURE_NAMES}')
+    return code
+
+def parse_value(text: str) -> int:
+    value = int(text, 0)
+    if not 0 <= value <= 0xffff:
+        raise argparse.ArgumentTypeError(f'{text} is not between 0 and 65535')
+    return value
+
+def select(monitors: list[Monitor], selector) -> list[Monitor]:
+    '''display number, bus (bus3, i2c-3), EDID key prefix, or part of "mfg model sn"'''
+    if selector is None:
+        return monitors
+    sel = selector.lower()
+    if sel.isdigit():
+        # an all digit EDID key prefix when no display has that number
+        by_number = [mon for mon in monitors if mon.display_idx == int(sel)]
+        if by_number:
+            return by_number
+    for prefix in ('bus', 'i2c-'):
+        if sel.startswith(prefix) and sel[len(prefix):].isdigit():
+            return [mon for mon in monitors if mon.bus == int(sel[len(prefix):])]
+    by_edid = [mon for mon in monitors if mon.edid_key.startswith(sel)]
+    if by_edid and len(sel) >= 4:
+        return by_edid
+    return [mon for mon in monitors if sel in f'{mon.manufacturer} {mon.model} {mon.sn}'.lower()]
+
+def connect(direct: bool):
+    '''(ddc, mode), the daemon when one runs, libddcutil in this process otherwise'''
+    client = None if direct else DaemonClient.connect()
+    if client:
+        return RemoteDDC(client), 'daemon'
+    from ddc_tray.ddc.ddcutil_cffi import DDC
+    return DDC(), 'direct'
+
+def run(ddc, args, mon: Monitor) -> str:
+    '''output for one monitor, commands on several monitors run in parallel'''
+    if args.command == 'list':
+        return f'{mon}  bus {mon.bus}  edid {mon.edid_key}  sn {mon.sn}  mccs {mon.vcp_ver}'
+    code = args.code
     with ddc.open_monitor(mon) as m:
-        # res = ddc.read_vcp(m, 0x1a) # blue gain
-        ddc.write_vcp(m, DDC.VCP.BRIGHTNESS.value, 10)
-        res = ddc.read_vcp(m, DDC.VCP.BRIGHTNESS.value)
-        print(res)
-    print()
+        if args.command == 'get':
+            res = ddc.read_vcp(m, code)
+            return f'{mon}: {res.value}/{res.max}'
+        elif args.command == 'set':
+            if code in CONTINUOUS and args.value > USUAL_MAX:
+                res = ddc.read_vcp(m, code)
+                if args.value > res.max:
+                    raise DDCError(DDCRC_ARG, f'0x{code:02x} = {args.value} (maximum {res.max})')
+            ddc.write_vcp(m, code, args.value)
+            return None
+        elif args.command in ('inc', 'dec'):
+            res = ddc.read_vcp(m, code)
+            step = args.value if args.command == 'inc' else -args.value
+            value = min(max(res.value + step, 0), res.max)
+            if value != res.value:
+                ddc.write_vcp(m, code, value)
+            return f'{mon}: {value}/{res.max}'
+        elif args.command == 'dump':
+            try:
+                codes = sorted(ddc.read_capabilities(m).features)
+            except DDCError:
+                codes = DUMP_CODES
+            return '\n'.join([str(mon)] + [f'  0x{c:02x}: ' +
+                (f'error {res.code}' if isinstance(res, DDCError) else f'{res.value}/{res.max}')
+                for c, res in ddc.read_vcp_many(m, codes).items()])
+
+def main():
+    parser = argparse.ArgumentParser(prog='python -m ddc_tray.ddc', description='DDC/CI monitor control')
+    parser.add_argument('command', choices=['list', 'get', 'set', 'inc', 'dec', 'dump'])
+    parser.add_argument('value', type=parse_value, nargs='?', help='value for set, step for inc/dec (default 10)')
+    parser.add_argument('-m', '--monitor', help='display number, bus3 / i2c-3, EDID key prefix or part of the name')
+    parser.add_argument('-c', '--code', type=parse_code, default='brightness',
+        help=f'VCP code like 0x12 or one of {FEATURE_NAMES} (default brightness)')
+    parser.add_argument('--direct', action='store_true', help='do not use the daemon')
+    parser.add_argument('--timing', action='store_true', help='print where the time of this invocation went')
+    args = parser.parse_args()
+    if args.command == 'set' and args.value is None:
+        parser.error('set needs a value')
+    if args.value is None:
+        args.value = 10
+
+    imported = time.perf_counter()
+    ddc, mode = connect(args.direct)
+    monitors = select(ddc.get_monitors(), args.monitor)
+    ready = time.perf_counter()
+    if not monitors:
+        print('no monitor matches', args.monitor, file=sys.stderr)
+    failed = False
+    with ThreadPoolExecutor(max_workers=max(len(monitors), 1)) as executor:
+        futures = [executor.submit(run, ddc, args, mon) for mon in monitors]
+        for mon, future in zip(monitors, futures):
+            try:
+                out = future.result()
+                if out:
+                    print(out)
+            except DDCError as e:
+                print(f'{mon}: {e}', file=sys.stderr)
+                failed = True
+    ddc.close()
+    done = time.perf_counter()
+    if args.timing:
+        # direct is the cold path (library init and enumeration), daemon the warm one
+        print(f'{mode}: total {(done - START)*1000:.1f} ms, imports {(imported - START)*1000:.1f} ms, '
+            f'{"connect + ls" if mode == "daemon" else "init + enumeration"} {(ready - imported)*1000:.1f} ms, '
+            f'{args.command} {(done - ready)*1000:.1f} ms', file=sys.stderr)
+    return 1 if failed or not monitors else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,57 @@
+import asyncio
+from concurrent.futures import ThreadPoolExecutor
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, VCP_result
+from ddc_tray.ddc.workers import IOPool
+
+class AsyncDDC:
+    '''asyncio front end for a DDC_Interface
+
+    Requests run on the IOPool worker of the display, which serializes them per
+    bus. At most max_pending requests are queued or running at once, further
+    ones wait without occupying a worker. Cancelling a request that has not
+    started on the bus removes it from the queue, a running one completes.
+    '''
+    def __init__(self, ddc: DDC_Interface, pool: IOPool, max_pending=16):
+        self.ddc = ddc
+        self.pool = pool
+        self.pending = asyncio.Semaphore(max_pending)
+        self.enum_executor = ThreadPoolExecutor(max_workers=1, thread_name_prefix='ddc-enum')
+
+    async def _run(self, future):
+        try:
+            return await asyncio.wrap_future(future)
+        except asyncio.CancelledError:
+            future.cancel()
+            raise
+
+    async def _call(self, mon: Monitor, fn, *args):
+        async with self.pending:
+            return await self._run(self.pool.submit(mon, fn, *args))
+
+    def _read(self, mon, code):
+        with self.ddc.open_monitor(mon) as m:
+            return self.ddc.read_vcp(m, code)
+
+    def _write(self, mon, code, value):
+        with self.ddc.open_monitor(mon) as m:
+            self.ddc.write_vcp(m, code, value)
+
+    async def run_async(self, mon: Monitor, fn, *args):
+        '''fn(*args) on the worker of mon, for helpers that combine several transactions'''
+        return await self._call(mon, fn, *args)
+
+    async def read_vcp_async(self, mon: Monitor, code: int) -> VCP_result:
+        return await self._call(mon, self._read, mon, code)
+
+    async def write_vcp_async(self, mon: Monitor, code: int, value: int):
+        return await self._call(mon, self._write, mon, code, value)
+
+    async def get_monitors_async(self) -> list[Monitor]:
+        return await self._run(self.enum_executor.submit(self.ddc.get_monitors))
+
+    async def update_buses_async(self, added: dict, removed: list) -> list[Monitor]:
+        # same executor as get_monitors, enumerations never overlap
+        return await self._run(self.enum_executor.submit(self.ddc.update_buses, added, removed))
+
+    def shutdown(self):
+        self.enum_executor.shutdown(wait=False, cancel_futures=True)
@@ -0,0 +1,115 @@
+import os
+import glob
+import math
+import time
+from ddc_tray.ddc.interface import Monitor
+
+class IIOLightSensor:
+    '''Ambient light in lux from an IIO sensor in sysfs, point sysfs_root to a fake tree for testing'''
+    def __init__(self, sysfs_root='/sys'):
+        self.path = None
+        for dev in sorted(glob.glob(os.path.join(sysfs_root, 'bus', 'iio', 'devices', 'iio:device*'))):
+            for name in ('in_illuminance_input', 'in_illuminance_raw'):
+                if os.path.exists(os.path.join(dev, name)):
+                    self.path = os.path.join(dev, name)
+                    self.scale = self._read(os.path.join(dev, 'in_illuminance_scale'), 1.0)
+                    self.offset = self._read(os.path.join(dev, 'in_illuminance_offset'), 0.0)
+                    break
+            if self.path:
+                break
+
+    def _read(self, path, default=None):
+        try:
+            with open(path) as f:
+                return float(f.read().strip())
+        except (OSError, ValueError):
+            return default
+
+    def available(self) -> bool:
+        return self.path is not None
+
+    def read(self):
+        raw = self._read(self.path)
+        return None if raw is None else (raw + self.offset) * self.scale
+
+class TimeOfDayCurve:
+    '''Pseudo lux from the local time, a half cosine between sunrise and sunset'''
+    def __init__(self, sunrise=7.0, sunset=19.0, night_lux=5.0, noon_lux=500.0, clock=time.localtime):
+        self.sunrise = sunrise
+        self.sunset = sunset
+        self.night_lux = night_lux
+        self.noon_lux = noon_lux
+        self.clock = clock
+
+    def read(self):
+        t = self.clock()
+        hour = t.tm_hour + t.tm_min / 60
+        if not self.sunrise < hour < self.sunset:
+            return self.night_lux
+        day = math.sin(math.pi * (hour - self.sunrise) / (self.sunset - self.sunrise))
+        return self.night_lux + (self.noon_lux - self.night_lux) * day
+
+class AutoAdjust:
+    '''Maps ambient light to per monitor brightness targets
+
+    Writes only happen on meaningful change: the smoothed light level has to
+    leave a relative hysteresis band around the level of the last write and the
+    new target has to differ by at least the deadband. Counts the writes a
+    naive poller (one write per monitor and poll) would have done as well.
+    '''
+    def __init__(self, source, apply, interval=5.0, min_lux=1.0, max_lux=1000.0, hysteresis=0.2,
+            deadband=5, smoothing=0.3, limits=None):
+        self.source = source
+        # seconds between ticks, for the per hour rates
+        self.interval = interval
+        # called as apply(mon, value) for each brightness write
+        self.apply = apply
+        self.min_lux = min_lux
+        self.max_lux = max_lux
+        self.hysteresis = hysteresis
+        self.deadband = deadband
+        self.smoothing = smoothing
+        # edid key -> (min %, max %) for monitors that need another range
+        self.limits = limits or {}
+        self.lux = None
+        # edid key -> (lux, value) at the last write
+        self.last = {}
+        self.polls = 0
+        self.writes = 0
+        self.naive_writes = 0
+
+    def target(self, mon: Monitor, lux: float) -> int:
+        lo, hi = self.limits.get(mon.edid_key, (0, 100))
+        lux = min(max(lux, self.min_lux), self.max_lux)
+        frac = math.log(lux / self.min_lux) / math.log(self.max_lux / self.min_lux)
+        return round(lo + (hi - lo) * frac)
+
+    def tick(self, monitors: list[Monitor]):
+        reading = self.source.read()
+        if reading is None:
+            return
+        self.polls += 1
+        self.lux = reading if self.lux is None else self.lux + self.smoothing * (reading - self.lux)
+        for mon in monitors:
+            self.naive_writes += 1
+            value = self.target(mon, self.lux)
+            last = self.last.get(mon.edid_key)
+            if last is not None:
+                last_lux, last_value = last
+                if abs(self.lux - last_lux) <= self.hysteresis * max(last_lux, self.min_lux):
+                    continue
+                if abs(value - last_value) < self.deadband:
+                    continue
+            self.last[mon.edid_key] = (self.lux, value)
+            self.writes += 1
+            self.apply(mon, value)
+
+    def stats(self):
+        hours = max(self.polls * self.interval, 1e-9) / 3600
+        return {
+            'polls': self.polls,
+            'writes': self.writes,
+            'naive_writes': self.naive_writes,
+            'writes_per_hour': self.writes / hours,
+            'saved_writes_per_hour': (self.naive_writes - self.writes) / hours,
+        }
@@ -0,0 +1,416 @@
+import os
+import argparse
+import json
+import random
+import tempfile
+import time
+import statistics
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, ffi as sim_ffi
+from ddc_tray.ddc.scheduler import CoalescingWriter
+from ddc_tray.ddc.workers import IOPool, write_all
+from ddc_tray.ddc.ambient import IIOLightSensor, AutoAdjust
+from ddc_tray.ddc.interface import Monitor, VCP_result, DDCError
+from ddc_tray.ddc.verify import WriteVerifier
+from ddc_tray.ddc.cache import VCPCache
+from ddc_tray.ddc.wheel import WheelAccumulator
+
+def bench_pool(args):
+    '''latency per write with open/close on every call vs pooled handles'''
+    for pool in (False, True):
+        ddc = DDC(sim_ffi, SimLib(monitors=1, time_scale=args.time_scale), pool=pool)
+        mon = ddc.get_monitors()[0]
+        start = time.perf_counter()
+        for i in range(args.n):
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, DDC.VCP.BRIGHTNESS.value, i % 100)
+        per_write = (time.perf_counter() - start) / args.n
+        ddc.close()
+        print(f'pool={pool}: {per_write*1000:.2f} ms/write')
+
+def bench_coalesce(args):
+    '''burst of n brightness steps, as produced by fast clicking through the menu'''
+    ddc = DDC(sim_ffi, SimLib(monitors=1, time_scale=args.time_scale))
+    mon = ddc.get_monitors()[0]
+    writer = CoalescingWriter(ddc)
+    start = time.perf_counter()
+    for i in range(args.n):
+        writer.write(mon, DDC.VCP.BRIGHTNESS.value, i % 101)
+    writer.join()
+    elapsed = time.perf_counter() - start
+    writer.close()
+    ddc.close()
+    print(f'{args.n} writes in {elapsed*1000:.2f} ms, {writer.stats()}')
+
+def run_op(ddc, fn, n):
+    '''latency percentiles of n calls of fn, with the libddcutil stats of the run'''
+    lib, ffi = ddc.lib, ddc.ffi
+    lib.ddca_reset_stats()
+    samples = []
+    start = time.perf_counter()
+    for i in range(n):
+        t0 = time.perf_counter()
+        fn(i)
+        samples.append(time.perf_counter() - t0)
+    elapsed = time.perf_counter() - start
+    lib.ddca_start_capture(lib.DDCA_CAPTURE_NOOPTS)
+    lib.ddca_show_stats(lib.DDCA_STATS_ALL, False, 0)
+    stats = ffi.string(lib.ddca_end_capture()).decode()
+    q = statistics.quantiles(samples, n=100, method='inclusive')
+    return {
+        'n': n,
+        'p50_ms': q[49] * 1000,
+        'p95_ms': q[94] * 1000,
+        'p99_ms': q[98] * 1000,
+        'ops_per_s': n / elapsed,
+        'ddca_stats': stats,
+    }
+
+def bench_suite(args):
+    '''latency and throughput of each DDC operation, on hardware with --real'''
+    if args.real:
+        ddc = DDC()
+    else:
+        ddc = DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale))
+    mon = ddc.get_monitors()[0]
+    code = DDC.VCP.BRIGHTNESS.value
+    with ddc.open_monitor(mon) as m:
+        res = ddc.read_vcp(m, code)
+    original = res.value
+
+    def open_monitor(i):
+        # drop the pooled handle so every call pays a real close and open
+        ddc.close_monitor(mon)
+        with ddc.open_monitor(mon):
+            pass
+    def read_vcp(i):
+        with ddc.open_monitor(mon) as m:
+            ddc.read_vcp(m, code)
+    def write_vcp(i):
+        with ddc.open_monitor(mon) as m:
+            ddc.write_vcp(m, code, original + (i % 2 if original < res.max else -(i % 2)))
+
+    runs = {
+        'get_monitors': run_op(ddc, lambda i: ddc.get_monitors(), max(2, args.n // 10)),
+        'open_monitor': run_op(ddc, open_monitor, args.n),
+        'read_vcp': run_op(ddc, read_vcp, args.n),
+        'write_vcp': run_op(ddc, write_vcp, args.n),
+    }
+    with ddc.open_monitor(mon) as m:
+        ddc.write_vcp(m, code, original)
+    ddc.close()
+
+    for op, r in runs.items():
+        print(f'{op:>13}: p50 {r["p50_ms"]:8.2f} ms  p95 {r["p95_ms"]:8.2f} ms  '
+            f'p99 {r["p99_ms"]:8.2f} ms  {r["ops_per_s"]:8.1f} ops/s')
+    if args.json:
+        result = {
+            'backend': 'ddcutil' if args.real else 'sim',
+            'time_scale': None if args.real else args.time_scale,
+            'timestamp': time.time(),
+            'runs': runs,
+        }
+        with open(args.json, 'w') as f:
+            json.dump(result, f, indent=2)
+
+def bench_many(args):
+    '''brightness, contrast, rgb gains and input source: single reads vs one read_vcp_many session'''
+    codes = [0x10, 0x12, 0x16, 0x18, 0x1a, 0x60]
+    for pool in (False, True):
+        ddc = DDC(sim_ffi, SimLib(monitors=1, time_scale=args.time_scale), pool=pool)
+        mon = ddc.get_monitors()[0]
+        start = time.perf_counter()
+        for _ in range(args.n):
+            for code in codes:
+                with ddc.open_monitor(mon) as m:
+                    ddc.read_vcp(m, code)
+        single = (time.perf_counter() - start) / args.n
+        start = time.perf_counter()
+        for _ in range(args.n):
+            with ddc.open_monitor(mon) as m:
+                ddc.read_vcp_many(m, codes)
+        many = (time.perf_counter() - start) / args.n
+        ddc.close()
+        print(f'pool={pool}: {len(codes)} single reads {single*1000:.2f} ms, read_vcp_many {many*1000:.2f} ms')
+
+def bench_fanout(args):
+    '''set brightness on all monitors, one after the other vs on per bus workers'''
+    ddc = DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale))
+    mons = ddc.get_monitors()
+    code = DDC.VCP.BRIGHTNESS.value
+    for i in range(args.n):
+        start = time.perf_counter()
+        done = []
+        for mon in mons:
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, code, i % 101)
+            done.append(time.perf_counter())
+    print(f'sequential: total {(done[-1] - start)*1000:.2f} ms, skew {(done[-1] - done[0])*1000:.2f} ms')
+    pool = IOPool()
+    for i in range(args.n):
+        result = write_all(ddc, pool, mons, code, i % 101).result()
+    print(f'parallel:   total {result.total_ms:.2f} ms, skew {result.skew_ms:.2f} ms')
+    pool.shutdown()
+    ddc.close()
+
+def bench_ambient(args):
+    '''an hour of a noisy, slowly brightening light sensor: hysteresis vs naive polling'''
+    root = tempfile.mkdtemp()
+    dev = os.path.join(root, 'bus', 'iio', 'devices', 'iio:device0')
+    os.makedirs(dev)
+    with open(os.path.join(dev, 'in_illuminance_input'), 'w') as f:
+        f.write('0')
+    sensor = IIOLightSensor(sysfs_root=root)
+    mons = [Monitor(display_idx=i, display_ref=None, model='', manufacturer='', vcp_ver='',
+        edid=bytes([i])) for i in range(args.monitors)]
+    interval = 5.0
+    auto = AutoAdjust(sensor, lambda mon, value: None, interval=interval)
+    rng = random.Random(1)
+    for i in range(int(3600 / interval)):
+        lux = 50 + 400 * i * interval / 3600
+        with open(os.path.join(dev, 'in_illuminance_input'), 'w') as f:
+            f.write(f'{lux * rng.uniform(0.85, 1.15):.1f}')
+        auto.tick(mons)
+    print({k: round(v, 1) for k, v in auto.stats().items()})
+
+def bench_verify(args):
+    '''write latency with ddca_enable_verify vs write-behind verification, 5% of writes silently dropped'''
+    code = DDC.VCP.BRIGHTNESS.value
+    ddc = DDC(sim_ffi, SimLib(monitors=1, time_scale=args.time_scale, seed=1, drop_rate=0.05))
+    mon = ddc.get_monitors()[0]
+
+    def write(value):
+        start = time.perf_counter()
+        try:
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, code, value)
+        except DDCError:
+            return time.perf_counter() - start, False
+        return time.perf_counter() - start, True
+
+    def read():
+        with ddc.open_monitor(mon) as m:
+            return ddc.read_vcp(m, code).value
+
+    for verify in (True, False):
+        pool = IOPool(initializer=lambda mon: ddc.set_verify(verify))
+        verifier = None if verify else WriteVerifier(ddc, pool, settle=0.02)
+        times, lost = [], 0
+        for i in range(args.n):
+            value = i % 101
+            elapsed, ok = pool.submit(mon, write, value).result()
+            times.append(elapsed)
+            if verifier and ok:
+                verifier.written(mon, code, value)
+            # user pause, long enough for the value to settle
+            time.sleep(0.05)
+            lost += pool.submit(mon, read).result() != value
+        if verifier:
+            verifier.close()
+        pool.shutdown()
+        print(f'verify={verify}: {statistics.mean(times)*1000:.2f} ms/write, {lost} values lost',
+            verifier.stats() if verifier else '')
+    ddc.close()
+
+def bench_retry(args):
+    '''default vs adaptive max tries: a good display that goes dark for a while and a flaky one'''
+    code = DDC.VCP.BRIGHTNESS.value
+    for adaptive in (False, True):
+        lib = SimLib(monitors=2, time_scale=args.time_scale, seed=1)
+        lib.displays[1].nak_rate = 0.45
+        ddc = DDC(sim_ffi, lib, adaptive_retries=adaptive)
+        pool = IOPool()
+        good, flaky = ddc.get_monitors()
+
+        def run(mon, n):
+            times, failed = [], 0
+            for i in range(n):
+                start = time.perf_counter()
+                try:
+                    with ddc.open_monitor(mon) as m:
+                        ddc.write_vcp(m, code, i % 101)
+                except DDCError:
+                    failed += 1
+                times.append(time.perf_counter() - start)
+            return times, failed
+
+        pool.submit(good, run, good, args.n).result()
+        lib.displays[0].nak_rate = 1.0
+        dark, _ = pool.submit(good, run, good, 10).result()
+        flaky_times, flaky_failed = pool.submit(flaky, run, flaky, args.n * 4).result()
+        print(f'adaptive={adaptive}: dark display {statistics.mean(dark)*1000:.2f} ms/failed write, '
+            f'flaky display {flaky_failed}/{args.n * 4} failed, {statistics.mean(flaky_times)*1000:.2f} ms/write')
+        if adaptive:
+            print(ddc.retry.stats())
+        pool.shutdown()
+        ddc.close()
+
+def bench_daemon(args):
+    '''monitor list and reads through the daemon vs a process enumerating by itself'''
+    import asyncio, threading
+    from ddc_tray.ddc.daemon import Daemon
+    from ddc_tray.ddc.client import DaemonClient, RemoteDDC
+    path = os.path.join(tempfile.mkdtemp(), 'ddc.sock')
+    loop = asyncio.new_event_loop()
+    daemon = Daemon(DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale)), path,
+        hotplug=False)
+    threading.Thread(target=loop.run_forever, daemon=True).start()
+    asyncio.run_coroutine_threadsafe(daemon.start(), loop).result()
+
+    start = time.perf_counter()
+    ddc = DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale))
+    mon = ddc.get_monitors()[0]
+    with ddc.open_monitor(mon) as m:
+        ddc.read_vcp(m, DDC.VCP.BRIGHTNESS.value)
+    print(f'direct: enumerate + first read {(time.perf_counter() - start)*1000:.2f} ms')
+    ddc.close()
+
+    start = time.perf_counter()
+    remote = RemoteDDC(DaemonClient(path))
+    mon = remote.get_monitors()[0]
+    with remote.open_monitor(mon) as m:
+        remote.read_vcp(m, DDC.VCP.BRIGHTNESS.value)
+    print(f'daemon: connect + ls + first read {(time.perf_counter() - start)*1000:.2f} ms')
+    times = []
+    for _ in range(args.n * 10):
+        start = time.perf_counter()
+        remote.client.call('ls')
+        times.append(time.perf_counter() - start)
+    print(f'daemon: ls round trip p50 {statistics.median(times)*1e6:.0f} us')
+    remote.close()
+    asyncio.run_coroutine_threadsafe(asyncio.sleep(0), loop).result()
+    loop.call_soon_threadsafe(daemon.close)
+
+class NullLib:
+    '''returns immediately, leaves only the python/cffi cost of a call'''
+    DDCA_NON_TABLE_VCP_VALUE = 1
+    DDCA_WRITE_ONLY_TRIES = 0
+    DDCA_WRITE_READ_TRIES = 1
+    def ddca_set_any_vcp_value(self, dh, code, valrec): return 0
+    def ddca_set_non_table_vcp_value(self, dh, code, hi, lo): return 0
+    def ddca_get_any_vcp_value_using_explicit_type(self, dh, code, value_type, valrec_loc):
+        valrec_loc[0] = self.valrec
+        return 0
+    def ddca_get_non_table_vcp_value(self, dh, code, valrec): return 0
+    def ddca_free_any_vcp_value(self, valrec): pass
+
+def bench_binding(args):
+    '''per call overhead of the binding with the bus time excluded, old any-value path vs now'''
+    lib = NullLib()
+    lib.valrec = sim_ffi.new('DDCA_Any_Vcp_Value *')
+    ddc = DDC(sim_ffi, lib)
+    dh = sim_ffi.NULL
+    # calls happen inside open_monitor, which sets the monitor of the thread
+    ddc.tls.mon = Monitor(display_idx=1, display_ref=None, model='', manufacturer='', vcp_ver='')
+    n = args.n * 1000
+
+    def old_write(value):
+        vcp_val = sim_ffi.new('DDCA_Any_Vcp_Value *', {
+            'opcode': 0x10,
+            'value_type': lib.DDCA_NON_TABLE_VCP_VALUE,
+            'val': {'c_nc': {'sl': value & 0xff, 'sh': (value >> 8) & 0xff}}
+        })
+        ddc._check(lib.ddca_set_any_vcp_value(dh, 0x10, vcp_val), 'ddca_set_any_vcp_value')
+    def old_read():
+        vcp_val = sim_ffi.new('DDCA_Any_Vcp_Value **')
+        ddc._check(lib.ddca_get_any_vcp_value_using_explicit_type(dh, 0x10,
+            lib.DDCA_NON_TABLE_VCP_VALUE, vcp_val), 'ddca_get_any_vcp_value_using_explicit_type')
+        data = vcp_val[0].val.c_nc
+        res = VCP_result(value=data.sh << 8 | data.sl, max=data.mh << 8 | data.ml)
+        lib.ddca_free_any_vcp_value(vcp_val[0])
+        return res
+
+    for name, fn in [('write any-value', lambda i: old_write(i & 0xff)),
+            ('write_vcp', lambda i: ddc.write_vcp(dh, 0x10, i & 0xff)),
+            ('read any-value', lambda i: old_read()),
+            ('read_vcp', lambda i: ddc.read_vcp(dh, 0x10))]:
+        start = time.perf_counter()
+        for i in range(n):
+            fn(i)
+        print(f'{name:>16}: {(time.perf_counter() - start) / n * 1e6:.2f} us/call')
+
+def bench_wheel(args):
+    '''one notch per 60 Hz frame on the tray icon: a relative write per event vs accumulated and paced'''
+    code = DDC.VCP.BRIGHTNESS.value
+    frame = 1 / 60
+    for accumulate in (False, True):
+        ddc = DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale))
+        mons = ddc.get_monitors()
+        pool = IOPool()
+        for mon in mons:
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, code, 20)
+        writes = [0]
+        def inc(mon):
+            # what a handler without accumulation does, like python -m ddc_tray.ddc inc 1
+            with ddc.open_monitor(mon) as m:
+                res = ddc.read_vcp(m, code)
+                ddc.write_vcp(m, code, min(res.value + 1, res.max))
+            writes[0] += 1
+        futures = []
+        cache = VCPCache(ddc)
+        writer = CoalescingWriter(ddc, executor_for=pool.executor_for, cache=cache,
+            on_result=lambda *_: writes.__setitem__(0, writes[0] + 1))
+        latency = {}
+        def timed_read(mon):
+            start = time.perf_counter()
+            res = cache.read(mon, code)
+            latency[mon.display_ref] = time.perf_counter() - start
+            return res
+        acc = WheelAccumulator(lambda mon, value: writer.write(mon, code, value),
+            lambda mon: cache.cached(mon, code), latency=lambda mon: latency.get(mon.display_ref), step=1)
+        for mon in mons:
+            pool.executor_for(mon).submit(timed_read, mon).result()
+        start = time.perf_counter()
+        for i in range(args.n):
+            for mon in mons:
+                if accumulate:
+                    acc.add(mon, 1)
+                else:
+                    futures.append(pool.executor_for(mon).submit(inc, mon))
+            if accumulate:
+                acc.flush()
+            time.sleep(max(0, start + (i + 1) * frame - time.perf_counter()))
+        last_event = time.perf_counter()
+        if accumulate:
+            while (wait := acc.flush()) is not None:
+                time.sleep(wait)
+            writer.join()
+        else:
+            for future in futures:
+                future.result()
+        settled = time.perf_counter() - last_event
+        finals = []
+        for mon in mons:
+            with ddc.open_monitor(mon) as m:
+                finals.append(ddc.read_vcp(m, code).value)
+        pool.shutdown()
+        ddc.close()
+        print(f'{"accumulated" if accumulate else "per event  "}: {args.n} notches x {len(mons)} monitors, '
+            f'{writes[0]} writes, final value landed {settled*1000:.0f} ms after the last notch, '
+            f'values {finals} (want {min(20 + args.n, 100)})')
+
+BENCHMARKS = {
+    'pool': bench_pool,
+    'coalesce': bench_coalesce,
+    'suite': bench_suite,
+    'many': bench_many,
+    'fanout': bench_fanout,
+    'ambient': bench_ambient,
+    'binding': bench_binding,
+    'verify': bench_verify,
+    'retry': bench_retry,
+    'daemon': bench_daemon,
+    'wheel': bench_wheel,
+}
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='DDC benchmarks')
+    parser.add_argument('bench', choices=BENCHMARKS)
+    parser.add_argument('-n', type=int, default=50)
+    parser.add_argument('--time-scale', type=float, default=1.0)
+    parser.add_argument('--monitors', type=int, default=1)
+    parser.add_argument('--real', action='store_true', help='use libddcutil and real monitors')
+    parser.add_argument('--json', help='write machine readable results to this file')
+    args = parser.parse_args()
+    BENCHMARKS[args.bench](args)
@@ -0,0 +1,176 @@
+import time
+import threading
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, Capabilities, DisplayCon, DDCError, VCP_result
+from ddc_tray.ddc.persist import data_path, load_json, save_json
+
+class MonitorCache:
+    '''Last monitor enumeration on disk
+
+    Lets the tray build its menu before the slow bus probe, cached monitors
+    have no display_ref until the probe confirmed them.
+    '''
+    def __init__(self, path=None):
+        self.path = path or data_path('monitors.json')
+        self.lock = threading.Lock()
+
+    def load(self) -> list[Monitor]:
+        entries = load_json(self.path, [])
+        try:
+            return [Monitor(
+                display_idx=e['dispno'],
+                display_ref=None,
+                model=e['model'],
+                manufacturer=e['mfg'],
+                vcp_ver=e['vcp_ver'],
+                bus=e['bus'],
+                sn=e['sn'],
+                edid=bytes.fromhex(e['edid'])
+            ) for e in entries]
+        except (KeyError, TypeError, ValueError):
+            return []
+
+    def save(self, monitors: list[Monitor]):
+        with self.lock:
+            save_json(self.path, [{
+                'dispno': mon.display_idx,
+                'model': mon.model,
+                'mfg': mon.manufacturer,
+                'vcp_ver': mon.vcp_ver,
+                'bus': mon.bus,
+                'sn': mon.sn,
+                'edid': mon.edid.hex(),
+            } for mon in monitors])
+
+def diff_monitors(old: dict, new: dict):
+    '''(added, changed, removed) between two enumerations keyed by monitor_ids(), as id -> Monitor'''
+    added, changed = {}, {}
+    for uid, mon in new.items():
+        prev = old.get(uid)
+        if prev is None:
+            added[uid] = mon
+        elif (prev.display_idx, prev.bus, prev.model, prev.manufacturer) != \
+                (mon.display_idx, mon.bus, mon.model, mon.manufacturer):
+            changed[uid] = mon
+    removed = {uid: mon for uid, mon in old.items() if uid not in new}
+    return added, changed, removed
+
+class CapabilitiesCache:
+    '''Parsed capabilities per EDID and firmware level
+
+    Reading the capabilities string is a multi part transfer taking a second or
+    more per monitor. The file is only read on first use.
+    '''
+    def __init__(self, path=None):
+        self.path = path or data_path('capabilities.json')
+        self.entries = None
+        # edid key -> key of the entry for the last seen firmware level
+        self.latest = None
+        self.lock = threading.Lock()
+
+    def _load(self):
+        if self.entries is None:
+            data = load_json(self.path, {})
+            try:
+                self.entries = {key: Capabilities(
+                    raw=e['raw'],
+                    mccs_ver=e['mccs_ver'],
+                    features={int(code): values for code, values in e['features'].items()}
+                ) for key, e in data.get('entries', {}).items()}
+                self.latest = dict(data.get('latest', {}))
+            except (AttributeError, KeyError, TypeError, ValueError):
+                self.entries, self.latest = {}, {}
+
+    def _save(self):
+        save_json(self.path, {
+            'latest': self.latest,
+            'entries': {key: {
+                'raw': caps.raw,
+                'mccs_ver': caps.mccs_ver,
+                'features': {str(code): values for code, values in caps.features.items()},
+            } for key, caps in self.entries.items()},
+        })
+
+    def cached(self, mon: Monitor):
+        '''capabilities from the last time the monitor was seen, without touching the bus'''
+        with self.lock:
+            self._load()
+            return self.entries.get(self.latest.get(mon.edid_key))
+
+    def get(self, ddc: DDC_Interface, con: DisplayCon, mon: Monitor) -> Capabilities:
+        '''cached capabilities for the current firmware level, read and stored on a miss'''
+        try:
+            firmware = ddc.read_vcp(con, DDC_Interface.VCP.FIRMWARE_LEVEL.value).value
+            firmware = f'{firmware >> 8}.{firmware & 0xff}'
+        except DDCError:
+            firmware = 'unknown'
+        key = f'{mon.edid_key}:{firmware}'
+        with self.lock:
+            self._load()
+            caps = self.entries.get(key)
+            if caps is not None and self.latest.get(mon.edid_key) == key:
+                return caps
+        if caps is None:
+            caps = ddc.read_capabilities(con)
+        with self.lock:
+            self.entries[key] = caps
+            self.latest[mon.edid_key] = key
+            self._save()
+        return caps
+
+class VCPCache:
+    '''Read cache for VCP values, keyed by display and feature code
+
+    Values we write are stored right away. Features the monitor changes on its
+    own (OSD, input source, power mode...) are volatile and always read from
+    the bus, everything else is cached for a per feature TTL in seconds.
+    '''
+    VOLATILE = {0x02, 0x52, 0x60, 0xca, 0xd6}
+    TTL = {0xc9: 3600.0, 0xdf: 3600.0}
+
+    def __init__(self, ddc: DDC_Interface, default_ttl=30.0, ttl=None, volatile=None):
+        self.ddc = ddc
+        self.default_ttl = default_ttl
+        self.ttl = {**self.TTL, **(ttl or {})}
+        self.volatile = set(self.VOLATILE if volatile is None else volatile)
+        self.values = {}
+        self.lock = threading.Lock()
+        self.hits = 0
+        self.misses = 0
+
+    def _ttl(self, code):
+        return 0.0 if code in self.volatile else self.ttl.get(code, self.default_ttl)
+
+    def cached(self, mon: Monitor, code: int):
+        '''cached VCP_result or None, never touches the bus'''
+        with self.lock:
+            entry = self.values.get((mon.display_ref, code))
+            if entry and time.monotonic() - entry[1] < self._ttl(code):
+                self.hits += 1
+                return entry[0]
+            self.misses += 1
+            return None
+
+    def read(self, mon: Monitor, code: int, fresh=False) -> VCP_result:
+        res = None if fresh else self.cached(mon, code)
+        if res is None:
+            with self.ddc.open_monitor(mon) as m:
+                res = self.ddc.read_vcp(m, code)
+            with self.lock:
+                self.values[(mon.display_ref, code)] = (res, time.monotonic())
+        return res
+
+    def update(self, mon: Monitor, code: int, value: int):
+        '''a value we wrote, the max is kept from the last read'''
+        with self.lock:
+            entry = self.values.get((mon.display_ref, code))
+            if entry:
+                self.values[(mon.display_ref, code)] = (VCP_result(value=value, max=entry[0].max), time.monotonic())
+
+    def invalidate(self, mon: Monitor, code=None):
+        with self.lock:
+            for key in [k for k in self.values if k[0] == mon.display_ref and code in (None, k[1])]:
+                del self.values[key]
+
+    def stats(self):
+        with self.lock:
+            return {'hits': self.hits, 'misses': self.misses}
@@ -0,0 +1,116 @@
+import time
+import threading
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, DDCError
+from ddc_tray.ddc.persist import data_path, load_json, save_json
+
+# candidates from the libddcutil default down, searched with bisection
+MULTIPLIERS = [1.0, 0.8, 0.6, 0.5, 0.4, 0.3, 0.25, 0.2, 0.15, 0.1]
+
+class SleepCalibration:
+    '''Lowest DDC sleep multiplier per monitor (by EDID) that works without retries
+
+    libddcutil keeps the multiplier per thread, so apply() and calibrate() have
+    to run on the worker thread that serves the monitor. Max tries are process
+    wide, calibrate() lowers them to 1 while holding DDC.max_tries_lock, so
+    calibrations run one at a time and other calls should not run meanwhile.
+    '''
+    def __init__(self, path=None):
+        self.path = path or data_path('sleep_multipliers.json')
+        self.results = load_json(self.path, {})
+        self.lock = threading.Lock()
+
+    def multiplier(self, mon: Monitor):
+        result = self.results.get(mon.edid_key)
+        return result['multiplier'] if result else None
+
+    def apply(self, ddc: DDC_Interface, mon: Monitor):
+        multiplier = self.multiplier(mon)
+        if multiplier is not None:
+            ddc.lib.ddca_set_sleep_multiplier(multiplier)
+
+    def initializer(self, ddc: DDC_Interface):
+        '''IOPool initializer for workers whose writes a WriteVerifier checks in the background'''
+        def init(mon: Monitor):
+            self.apply(ddc, mon)
+            ddc.set_verify(False)
+        return init
+
+    def _clean(self, ddc, mon, multiplier, code, base, samples):
+        # no verify failure and, with max tries at 1, no retry needed
+        ddc.lib.ddca_set_sleep_multiplier(multiplier)
+        try:
+            with ddc.open_monitor(mon) as m:
+                for i in range(samples):
+                    value = base + i % 2
+                    ddc.write_vcp(m, code, value)
+                    if ddc.read_vcp(m, code).value != value:
+                        return False
+            return True
+        except DDCError:
+            return False
+
+    def calibrate(self, ddc: DDC_Interface, mon: Monitor, code=DDC_Interface.VCP.BRIGHTNESS.value, samples=5):
+        lib = ddc.lib
+        retry_types = [lib.DDCA_WRITE_ONLY_TRIES, lib.DDCA_WRITE_READ_TRIES]
+        saved_multiplier = lib.ddca_get_sleep_multiplier()
+        with ddc.open_monitor(mon) as m:
+            original = ddc.read_vcp(m, code)
+        base = min(original.value, max(original.max - 1, 0))
+
+        best = None
+        lo, hi = 0, len(MULTIPLIERS) - 1
+        with ddc.max_tries_lock:
+            saved_tries = [lib.ddca_get_max_tries(t) for t in retry_types]
+            for t in retry_types:
+                lib.ddca_set_max_tries(t, 1)
+            try:
+                while lo <= hi:
+                    mid = (lo + hi) // 2
+                    if self._clean(ddc, mon, MULTIPLIERS[mid], code, base, samples):
+                        best, lo = MULTIPLIERS[mid], mid + 1
+                    else:
+                        hi = mid - 1
+            finally:
+                for t, tries in zip(retry_types, saved_tries):
+                    lib.ddca_set_max_tries(t, tries)
+
+        # leave the result applied on this thread
+        lib.ddca_set_sleep_multiplier(best or saved_multiplier)
+        with ddc.open_monitor(mon) as m:
+            ddc.write_vcp(m, code, original.value)
+        if best is not None:
+            with self.lock:
+                self.results[mon.edid_key] = {'multiplier': best, 'model': str(mon), 'time': time.time()}
+                save_json(self.path, self.results)
+        return best
+
+if __name__ == '__main__':
+    from ddc_tray.ddc.ddcutil_cffi import DDC
+    from ddc_tray.ddc.workers import IOPool
+
+    ddc = DDC()
+    calibration = SleepCalibration()
+    pool = IOPool(initializer=lambda mon: calibration.apply(ddc, mon))
+    code = DDC.VCP.BRIGHTNESS.value
+
+    def write_latency(mon, n=5):
+        with ddc.open_monitor(mon) as m:
+            value = ddc.read_vcp(m, code).value
+            start = time.perf_counter()
+            for _ in range(n):
+                ddc.write_vcp(m, code, value)
+            return (time.perf_counter() - start) / n * 1000
+
+    monitors = ddc.get_monitors()
+    # the measurements run in parallel, the calibrations one after another since
+    # max tries of 1 during a calibration would apply to the other buses too
+    before = {mon.display_idx: pool.submit(mon, write_latency, mon) for mon in monitors}
+    before = {i: future.result() for i, future in before.items()}
+    results = {mon.display_idx: pool.submit(mon, calibration.calibrate, ddc, mon).result() for mon in monitors}
+    after = {mon.display_idx: pool.submit(mon, write_latency, mon) for mon in monitors}
+    for mon in monitors:
+        i = mon.display_idx
+        print(f'{mon}: multiplier {results[i]}, '
+            f'write {before[i]:.1f} ms -> {after[i].result():.1f} ms')
+    pool.shutdown()
+    ddc.close()
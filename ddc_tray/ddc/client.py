@@ -0,0 +1,161 @@
+import json
+import socket
+import threading
+from contextlib import contextmanager
+from concurrent.futures import Future, TimeoutError as FutureTimeout
+from ddc_tray.ddc.interface import (DDC_Interface, Monitor, VCP_result, DisplayCon, DDCError, Capabilities,
+    DDCRC_INVALID_DISPLAY)
+from ddc_tray.ddc.protocol import socket_path, monitor_from_json
+
+class DaemonClient:
+    '''Connection to the daemon, thread safe, requests from several threads are pipelined
+
+    A lost connection or a request without an answer within timeout seconds
+    fails with DDCError, the connection is not usable after a loss (alive).
+    '''
+    def __init__(self, path=None, timeout=5.0):
+        self.path = path or socket_path()
+        self.timeout = timeout
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            self.sock.connect(self.path)
+        except OSError:
+            self.sock.close()
+            raise
+        self.file = self.sock.makefile('rb')
+        self.next_id = 0
+        self.pending = {}
+        self.alive = True
+        self.lock = threading.Lock()
+        self.reader = threading.Thread(target=self._read, name='ddc-client', daemon=True)
+        self.reader.start()
+
+    @classmethod
+    def connect(cls, path=None, timeout=5.0):
+        '''a client, or None if no daemon is listening'''
+        try:
+            return cls(path, timeout)
+        except OSError:
+            return None
+
+    def _read(self):
+        try:
+            for line in self.file:
+                rid, rc, payload = json.loads(line)
+                with self.lock:
+                    future = self.pending.pop(rid, None)
+                if future is None:
+                    # timed out already
+                    continue
+                if rc == 0:
+                    future.set_result(payload)
+                else:
+                    future.set_exception(DDCError(rc, payload))
+        except (OSError, ValueError):
+            pass
+        # daemon went away, or close()
+        with self.lock:
+            self.alive = False
+            pending, self.pending = self.pending, {}
+        self.file.close()
+        self.sock.close()
+        for future in pending.values():
+            future.set_exception(DDCError(-1, 'daemon connection lost'))
+
+    def _send(self, op: str, args) -> tuple[int, Future]:
+        future = Future()
+        with self.lock:
+            if not self.alive:
+                raise DDCError(-1, 'daemon connection lost')
+            rid = self.next_id
+            self.next_id += 1
+            self.pending[rid] = future
+            try:
+                self.sock.sendall(json.dumps([rid, op, *args], separators=(',', ':')).encode() + b'\n')
+            except OSError as e:
+                del self.pending[rid]
+                self.alive = False
+                raise DDCError(-1, f'daemon connection lost: {e}') from e
+        return rid, future
+
+    def call_async(self, op: str, *args) -> Future:
+        return self._send(op, args)[1]
+
+    def call(self, op: str, *args):
+        rid, future = self._send(op, args)
+        try:
+            return future.result(self.timeout)
+        except FutureTimeout:
+            with self.lock:
+                self.pending.pop(rid, None)
+            raise DDCError(-1, f'{op}: no answer from the daemon in {self.timeout} s') from None
+
+    def close(self):
+        with self.lock:
+            self.alive = False
+        try:
+            self.sock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        self.sock.close()
+
+class RemoteDDC(DDC_Interface):
+    '''DDC_Interface backed by the daemon, the connection of a monitor is its id
+
+    After the connection was lost the next call connects again, to a restarted
+    daemon. Monitor ids are EDID keys, they stay valid across the restart.
+    '''
+    def __init__(self, client: DaemonClient):
+        self.client = client
+        self.lock = threading.Lock()
+        self.monitors = []
+        # settings of the libddcutil threads live in the daemon
+        self.telemetry = None
+        self.retry = None
+
+    def _call(self, op: str, *args):
+        with self.lock:
+            client = self.client
+            if not client.alive:
+                try:
+                    client = self.client = DaemonClient(client.path, client.timeout)
+                except OSError as e:
+                    raise DDCError(-1, f'daemon not running: {e}') from e
+        return client.call(op, *args)
+
+    def _list(self, data):
+        self.monitors = [monitor_from_json(mon) for mon in data]
+        return self.monitors
+
+    def get_monitors(self):
+        return self._list(self._call('ls'))
+
+    def update_buses(self, added: dict, removed: list):
+        # the daemon watches the buses itself, sync only catches up with it
+        return self._list(self._call('sync'))
+
+    @contextmanager
+    def open_monitor(self, mon: Monitor):
+        if mon.display_ref is None:
+            raise DDCError(DDCRC_INVALID_DISPLAY, f'{mon} not detected')
+        yield mon.display_ref
+
+    def read_vcp(self, con: DisplayCon, code: int):
+        return VCP_result(*self._call('get', con, code))
+
+    def read_vcp_many(self, con: DisplayCon, codes: list[int]) -> dict:
+        results = self._call('many', con, codes)
+        return {int(code): DDCError(*res) if res[0] < 0 else VCP_result(*res) for code, res in results.items()}
+
+    def write_vcp(self, con: DisplayCon, code: int, value: int):
+        self._call('set', con, code, value)
+
+    def read_capabilities(self, con: DisplayCon) -> Capabilities:
+        raw, mccs_ver, features = self._call('caps', con)
+        return Capabilities(raw=raw, mccs_ver=mccs_ver, features={int(k): v for k, v in features.items()})
+
+    def close_monitor(self, mon: Monitor):
+        pass
+
+    def close(self):
+        self.client.close()
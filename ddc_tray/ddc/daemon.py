@@ -0,0 +1,210 @@
+import os
+import sys
+import socket
+import signal
+import json
+import asyncio
+import argparse
+from ddc_tray.ddc.interface import Monitor, DDCError, DDCRC_INVALID_DISPLAY
+from ddc_tray.ddc.workers import IOPool
+from ddc_tray.ddc.aio import AsyncDDC
+from ddc_tray.ddc.calibrate import SleepCalibration
+from ddc_tray.ddc.hotplug import HotplugWatcher
+from ddc_tray.ddc.verify import WriteVerifier
+from ddc_tray.ddc.protocol import socket_path, monitor_to_json
+from ddc_tray.ddc.persist import data_path
+
+class Daemon:
+    '''Owns enumeration, the handle pool and the per bus workers for all clients
+
+    Clients never enumerate, ls answers from the registry. Every bus
+    transaction of every client goes through the one IOPool, so two clients
+    cannot collide on a bus. The protocol is described in protocol.py.
+    With telemetry on, textfile is rewritten every textfile_interval seconds
+    for the node_exporter textfile collector.
+    '''
+    def __init__(self, ddc, path=None, hotplug=True, calibration=None, textfile=None, textfile_interval=15.0):
+        self.ddc = ddc
+        self.path = path or socket_path()
+        self.textfile = textfile if ddc.telemetry else None
+        self.textfile_interval = textfile_interval
+        self.textfile_task = None
+        self.calibration = calibration or SleepCalibration()
+        self.pool = IOPool(initializer=self.calibration.initializer(ddc))
+        self.aio = AsyncDDC(ddc, self.pool)
+        self.verifier = WriteVerifier(ddc, self.pool)
+        self.hotplug = HotplugWatcher(self._hotplug) if hotplug else None
+        self.loop = None
+        self.server = None
+        self.ops = {
+            'ls': self.op_ls,
+            'sync': self.op_sync,
+            'get': self.op_get,
+            'many': self.op_many,
+            'set': self.op_set,
+            'caps': self.op_caps,
+            'stats': self.op_stats,
+        }
+
+    def _hotplug(self, added, removed):
+        asyncio.run_coroutine_threadsafe(self.aio.update_buses_async(added, removed), self.loop)
+
+    def _monitor(self, uid: str) -> Monitor:
+        mon = self.ddc.registry.get(uid)
+        if mon is None:
+            raise DDCError(DDCRC_INVALID_DISPLAY, f'monitor {uid}')
+        return mon
+
+    def _list(self):
+        return [monitor_to_json(mon, self.ddc.registry.id_of(mon)) for mon in self.ddc.monitors]
+
+    async def op_ls(self):
+        return self._list()
+
+    async def op_sync(self):
+        if self.hotplug:
+            added, removed = await asyncio.get_running_loop().run_in_executor(
+                self.aio.enum_executor, self.hotplug.poll)
+            if added or removed:
+                await self.aio.update_buses_async(added, removed)
+        return self._list()
+
+    async def op_get(self, uid, code):
+        res = await self.aio.read_vcp_async(self._monitor(uid), code)
+        return [res.value, res.max]
+
+    def _many(self, mon, codes):
+        with self.ddc.open_monitor(mon) as m:
+            return self.ddc.read_vcp_many(m, codes)
+
+    async def op_many(self, uid, codes):
+        mon = self._monitor(uid)
+        results = await asyncio.wrap_future(self.pool.submit(mon, self._many, mon, codes))
+        return {code: [res.code, res.msg] if isinstance(res, DDCError) else [res.value, res.max]
+            for code, res in results.items()}
+
+    async def op_set(self, uid, code, value):
+        mon = self._monitor(uid)
+        await self.aio.write_vcp_async(mon, code, value)
+        self.verifier.written(mon, code, value)
+
+    def _caps(self, mon):
+        with self.ddc.open_monitor(mon) as m:
+            return self.ddc.read_capabilities(m)
+
+    async def op_caps(self, uid):
+        mon = self._monitor(uid)
+        caps = await asyncio.wrap_future(self.pool.submit(mon, self._caps, mon))
+        return [caps.raw, caps.mccs_ver, caps.features]
+
+    async def op_stats(self):
+        return {
+            'telemetry': self.ddc.telemetry.snapshot() if self.ddc.telemetry else None,
+            'retry': self.ddc.retry.stats() if self.ddc.retry else None,
+            'verify': self.verifier.stats(),
+        }
+
+    async def _request(self, line, writer):
+        rid, op = None, 'request'
+        try:
+            rid, op, *args = json.loads(line)
+            response = [rid, 0, await self.ops[op](*args)]
+        except DDCError as e:
+            response = [rid, e.code, e.msg]
+        except Exception as e:
+            response = [rid, -1, f'{op} ({type(e).__name__}: {e})']
+        writer.write(json.dumps(response, separators=(',', ':')).encode() + b'\n')
+
+    async def _client(self, reader, writer):
+        tasks = set()
+        try:
+            while line := await reader.readline():
+                task = asyncio.create_task(self._request(line, writer))
+                tasks.add(task)
+                task.add_done_callback(tasks.discard)
+        finally:
+            for task in tasks:
+                task.cancel()
+            writer.close()
+
+    @staticmethod
+    def running(path: str) -> bool:
+        '''whether a daemon answers on path, a socket file nobody listens on is stale'''
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            try:
+                sock.connect(path)
+                return True
+            except OSError:
+                return False
+
+    async def _write_textfile(self):
+        while True:
+            await asyncio.to_thread(self.ddc.telemetry.write_textfile, self.textfile)
+            await asyncio.sleep(self.textfile_interval)
+
+    async def start(self):
+        '''OSError if another daemon serves the socket, two of them would share the buses'''
+        if self.running(self.path):
+            raise OSError(f'a daemon is already listening on {self.path}')
+        self.loop = asyncio.get_running_loop()
+        await self.aio.get_monitors_async()
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        self.server = await asyncio.start_unix_server(self._client, self.path)
+        os.chmod(self.path, 0o600)
+        if self.hotplug:
+            self.hotplug.start()
+        if self.textfile:
+            self.textfile_task = asyncio.create_task(self._write_textfile())
+
+    async def serve_forever(self):
+        await self.start()
+        try:
+            await self.server.serve_forever()
+        finally:
+            self.close()
+
+    def close(self):
+        if self.textfile_task:
+            self.textfile_task.cancel()
+            self.textfile_task = None
+        if self.hotplug:
+            self.hotplug.stop()
+        if self.server:
+            self.server.close()
+            self.server = None
+            if os.path.exists(self.path):
+                os.unlink(self.path)
+        self.verifier.close()
+        self.aio.shutdown()
+        self.pool.shutdown()
+        self.ddc.close()
+
+if __name__ == '__main__':
+    from ddc_tray.ddc.ddcutil_cffi import DDC
+    parser = argparse.ArgumentParser(description='DDC daemon, serves all ddc-tray clients')
+    parser.add_argument('--socket', help=f'default {socket_path()}')
+    parser.add_argument('--metrics-port', type=int, default=9464, help='0 to turn the endpoint off')
+    parser.add_argument('--textfile', default=os.environ.get('DDC_TRAY_TEXTFILE') or data_path('ddc_tray.prom'),
+        help='prometheus textfile, empty to turn it off')
+    args = parser.parse_args()
+    path = args.socket or socket_path()
+    # checked again when binding, this only saves the library init
+    if Daemon.running(path):
+        sys.exit(f'a daemon is already listening on {path}')
+    ddc = DDC(telemetry=True, adaptive_retries=True)
+    if args.metrics_port:
+        ddc.telemetry.serve(args.metrics_port)
+    daemon = Daemon(ddc, path, textfile=args.textfile or None)
+    print('listening on', daemon.path, file=sys.stderr)
+
+    async def main():
+        # SIGTERM cancels the server, serve_forever cleans up the socket
+        asyncio.get_running_loop().add_signal_handler(signal.SIGTERM, asyncio.current_task().cancel)
+        await daemon.serve_forever()
+    try:
+        asyncio.run(main())
+    except (KeyboardInterrupt, asyncio.CancelledError):
+        pass
+    except OSError as e:
+        sys.exit(str(e))
@@ -1,61 +1,282 @@
+import os
+import sys
 import time
-from ._ddc_cffi import ffi, lib
-from ddc_tray.ddc.interface import DDC_Interface, Monitor, VCP_result, DisplayCon
+import threading
+from ddc_tray.ddc.interface import (DDC_Interface, Monitor, VCP_result, DisplayCon, DDCError, Capabilities,
+    parse_edid, DDCRC_ARG, DDCRC_INVALID_DISPLAY)
+from ddc_tray.ddc.registry import MonitorRegistry
+from ddc_tray.ddc.telemetry import Telemetry
+from ddc_tray.ddc.retry import RetryPolicy
 from contextlib import contextmanager
+try:
+    from ._ddc_cffi import ffi as _ffi, lib as _lib
+except ImportError:
+    # extension not built (no libddcutil), only a simulated backend can be used
+    _ffi = _lib = None
 
 class DDC(DDC_Interface):
+    # libddcutil keeps max tries per process, code that changes them for a while holds this
+    max_tries_lock = threading.Lock()
+
+    def __init__(self, ffi=None, lib=None, pool=True, telemetry=False, adaptive_retries=False):
+        if lib is None and os.environ.get('DDC_TRAY_SIM'):
+            from ddc_tray.ddc.ddcutil_sim import SimLib, ffi
+            lib = SimLib.from_env()
+        if lib is None and _lib is None:
+            raise ImportError('_ddc_cffi is not built, run build.py or pass a simulated lib')
+        self.ffi = ffi or _ffi
+        self.lib = lib or _lib
+        # latency and return codes of every ddca_* call, see telemetry.py
+        self.telemetry = None
+        if telemetry:
+            self.telemetry = Telemetry(self.ffi, self.lib)
+            self.lib = self.telemetry.instrument(self.lib)
+        # max tries adapted to what the displays need, see retry.py
+        self.retry = RetryPolicy(self.lib, lock=self.max_tries_lock) if adaptive_retries else None
+        self.registry = MonitorRegistry()
+        # one open handle per display ref, kept until error, unplug or close()
+        self.pool = pool
+        # display ref -> [handle, users, stale], a stale handle is closed by its last user
+        self.handles = {}
+        # display refs being opened, other users of the same display wait for that handle
+        self.opening = set()
+        self.handles_lock = threading.Condition()
+        # per thread response struct for read_vcp, no allocation per call
+        self.tls = threading.local()
+
+    def _check(self, ret, what):
+        if ret != 0:
+            raise DDCError(ret, what)
+
+    def _tries(self, retry_type, fn, *args):
+        '''fn(*args) under the retry policy of the monitor opened on this thread'''
+        if self.retry is None:
+            return fn(*args)
+        mon = getattr(self.tls, 'mon', None)
+        if mon is None:
+            return fn(*args)
+        self.retry.before(mon, retry_type)
+        start = time.perf_counter()
+        ret = fn(*args)
+        self.retry.observe(mon, retry_type, time.perf_counter() - start, ret)
+        return ret
+
+    @property
+    def monitors(self) -> list[Monitor]:
+        return self.registry.monitors
+
     def get_monitors(self):
+        ffi, lib = self.ffi, self.lib
         x = ffi.new('DDCA_Display_Info_List **')
-        ret = lib.ddca_get_display_info_list2(True, x)
-        print('code', ret)
+        self._check(lib.ddca_get_display_info_list2(True, x), 'ddca_get_display_info_list2')
         # lib.ddca_report_display_info_list(x[0], 0)
 
-        # de ref with [0] instead of *
-        monitor_count = x[0].ct
-        # no builtin iteration for further array deref, use generator/comprehension
-        monitors = x[0].info
-        self.monitors = (Monitor(
-            display_idx=monitors[i].dispno,
-            display_ref=monitors[i].dref,
-            model=ffi.string(monitors[i].model_name).decode(),
-            manufacturer=ffi.string(monitors[i].mfg_id).decode(),
-            vcp_ver=f'{monitors[i].vcp_version.major}.{monitors[i].vcp_version.minor}'
-        ) for i in range(monitor_count))
+        # everything is copied out of the list, it is freed before returning.
+        # the display refs stay valid, libddcutil owns them until it redetects
+        try:
+            # de ref with [0] instead of *
+            monitor_count = x[0].ct
+            # no builtin iteration for further array deref, use generator/comprehension
+            monitors = x[0].info
+            found = [Monitor(
+                display_idx=monitors[i].dispno,
+                display_ref=monitors[i].dref,
+                model=ffi.string(monitors[i].model_name).decode(),
+                manufacturer=ffi.string(monitors[i].mfg_id).decode(),
+                vcp_ver=f'{monitors[i].vcp_version.major}.{monitors[i].vcp_version.minor}',
+                bus=monitors[i].path.path.i2c_busno if monitors[i].path.io_mode == lib.DDCA_IO_I2C else -1,
+                sn=ffi.string(monitors[i].sn).decode(),
+                edid=bytes(ffi.buffer(monitors[i].edid_bytes))
+            ) for i in range(monitor_count)]
+        finally:
+            lib.ddca_free_display_info_list(x[0])
+
+        self._replace(found)
+        return self.monitors
+
+    def _replace(self, found: list[Monitor]):
+        old_refs = {mon.display_ref for mon in self.registry}
+        _, removed = self.registry.replace(found)
+        # drop handles of displays that are gone (hot-unplug) or got a new ref
+        for dref in old_refs - set(self.registry.by_ref):
+            self._release(dref)
+        if self.retry:
+            # stats are per EDID, a twin that is still there keeps them
+            keys = {mon.edid_key for mon in self.registry}
+            for mon in removed:
+                if mon.edid_key not in keys:
+                    self.retry.forget(mon)
 
+    def update_buses(self, added: dict, removed: list):
+        '''incremental re-enumeration, added maps i2c bus to EDID, removed lists buses'''
+        for bus in list(added) + list(removed):
+            mon = self.registry.bus(bus)
+            if mon:
+                self._release(mon.display_ref)
+        kept = [mon for mon in self.monitors if mon.bus not in removed and mon.bus not in added]
+        probed = []
+        for bus, edid in added.items():
+            try:
+                probed.append(self.probe_bus(bus, edid))
+            except DDCError as e:
+                # libddcutil only hands out refs of the monitors its detection at
+                # startup saw, and this API cannot redetect. The monitor is listed
+                # without a display ref, like a cached one, until a restart
+                print(f'i2c-{bus}: {e}, the monitor was plugged after libddcutil detected '
+                    'the displays, restart to use it', file=sys.stderr)
+                probed.append(self._bus_monitor(bus, edid, None))
+        self._replace(kept + probed)
         return self.monitors
 
+    def probe_bus(self, bus: int, edid: bytes = b''):
+        '''Monitor on a single i2c bus without probing the other buses,
+        DDCError if libddcutil has no display ref for the bus'''
+        ffi, lib = self.ffi, self.lib
+        did = ffi.new('DDCA_Display_Identifier *')
+        self._check(lib.ddca_create_busno_display_identifier(bus, did), 'ddca_create_busno_display_identifier')
+        dref = ffi.new('DDCA_Display_Ref *')
+        try:
+            self._check(lib.ddca_get_display_ref(did[0], dref), 'ddca_get_display_ref')
+        finally:
+            lib.ddca_free_display_identifier(did[0])
+        mon = self._bus_monitor(bus, edid, dref[0])
+        vspec = ffi.new('DDCA_MCCS_Version_Spec *')
+        try:
+            with self.open_monitor(mon) as dh:
+                if lib.ddca_get_mccs_version_by_dh(dh, vspec) == 0:
+                    mon.vcp_ver = f'{vspec.major}.{vspec.minor}'
+        except DDCError:
+            pass
+        return mon
+
+    def _bus_monitor(self, bus: int, edid: bytes, dref):
+        prev = self.registry.bus(bus)
+        mfg, model, sn = parse_edid(edid)
+        return Monitor(
+            display_idx=prev.display_idx if prev else max((m.display_idx for m in self.monitors), default=0) + 1,
+            display_ref=dref,
+            model=model,
+            manufacturer=mfg,
+            vcp_ver='',
+            bus=bus,
+            sn=sn,
+            edid=edid
+        )
+
+    def _acquire(self, mon: Monitor):
+        if mon.display_ref is None:
+            # e.g. loaded from the monitor cache and not yet seen on the bus
+            raise DDCError(DDCRC_INVALID_DISPLAY, f'{mon} not detected')
+        dref = mon.display_ref
+        with self.handles_lock:
+            while dref in self.opening:
+                self.handles_lock.wait()
+            entry = self.handles.get(dref)
+            if entry is not None:
+                entry[1] += 1
+                return entry
+            if self.pool:
+                self.opening.add(dref)
+        # the open is bus i/o, it runs outside the lock so other buses are not held up
+        display_handle = self.ffi.new('DDCA_Display_Handle *')
+        ret = None
+        try:
+            ret = self.lib.ddca_open_display2(dref, True, display_handle)
+        finally:
+            with self.handles_lock:
+                entry = [display_handle[0], 1, not self.pool]
+                if self.pool:
+                    self.opening.discard(dref)
+                    self.handles_lock.notify_all()
+                    if ret == 0:
+                        self.handles[dref] = entry
+        self._check(ret, 'ddca_open_display2')
+        return entry
+
+    def _unuse(self, entry):
+        with self.handles_lock:
+            entry[1] -= 1
+            close = entry[2] and entry[1] == 0
+        if close:
+            self.lib.ddca_close_display(entry[0])
+
+    def _release(self, dref):
+        with self.handles_lock:
+            entry = self.handles.pop(dref, None)
+            if entry is None:
+                return
+            # still in use by another thread, its last user closes it
+            entry[2] = True
+            close = entry[1] == 0
+        if close:
+            self.lib.ddca_close_display(entry[0])
+
+    def close_monitor(self, mon: Monitor):
+        self._release(mon.display_ref)
+
+    def set_verify(self, enabled: bool):
+        '''read back after each write, applies to the calling thread'''
+        return self.lib.ddca_enable_verify(enabled)
+
+    def close(self):
+        for dref in list(self.handles):
+            self._release(dref)
+
     @contextmanager
     def open_monitor(self, mon: Monitor):
-        display_handle = ffi.new('DDCA_Display_Handle *')
-        ret = lib.ddca_open_display2(mon.display_ref, True, display_handle)
+        entry = self._acquire(mon)
+        outer, self.tls.mon = getattr(self.tls, 'mon', None), mon
         try:
-            yield display_handle[0]
+            yield entry[0]
+        except DDCError:
+            # handle may be stale, reopen lazily on next use
+            with self.handles_lock:
+                if self.handles.get(mon.display_ref) is entry:
+                    del self.handles[mon.display_ref]
+                    entry[2] = True
+            raise
         finally:
-            ret = lib.ddca_close_display(display_handle[0])
+            self.tls.mon = outer
+            self._unuse(entry)
 
     def read_vcp(self, con: DisplayCon, code: int):
-        vcp_val = ffi.new('DDCA_Any_Vcp_Value **')
-        ret = lib.ddca_get_any_vcp_value_using_explicit_type(con, code, 
-            lib.DDCA_NON_TABLE_VCP_VALUE, vcp_val)
+        data = getattr(self.tls, 'valrec', None)
+        if data is None:
+            data = self.tls.valrec = self.ffi.new('DDCA_Non_Table_Vcp_Value *')
+        ret = self._tries(self.lib.DDCA_WRITE_READ_TRIES, self.lib.ddca_get_non_table_vcp_value, con, code, data)
+        self._check(ret, 'ddca_get_non_table_vcp_value')
 
-        data = vcp_val[0].val.c_nc
         return VCP_result(
             value=data.sh << 8 | data.sl,
             max=data.mh << 8 | data.ml
         )
 
+    def read_capabilities(self, con: DisplayCon) -> Capabilities:
+        ffi, lib = self.ffi, self.lib
+        caps = ffi.new('char **')
+        self._check(self._tries(lib.DDCA_MULTI_PART_TRIES, lib.ddca_get_capabilities_string, con, caps),
+            'ddca_get_capabilities_string')
+        parsed = ffi.new('DDCA_Capabilities **')
+        try:
+            raw = ffi.string(caps[0]).decode(errors='replace')
+            self._check(lib.ddca_parse_capabilities_string(caps[0], parsed), 'ddca_parse_capabilities_string')
+        finally:
+            lib.free(caps[0])
+        p = parsed[0]
+        res = Capabilities(
+            raw=raw,
+            mccs_ver=f'{p.version_spec.major}.{p.version_spec.minor}',
+            features={p.vcp_codes[i].feature_code:
+                [p.vcp_codes[i].values[j] for j in range(p.vcp_codes[i].value_ct)]
+                for i in range(p.vcp_code_ct)}
+        )
+        lib.ddca_free_parsed_capabilities(p)
+        return res
+
     def write_vcp(self, con: DisplayCon, code: int, value: int):
-        vcp_val = ffi.new('DDCA_Any_Vcp_Value *', {
-            'opcode': code,
-            'value_type': lib.DDCA_NON_TABLE_VCP_VALUE,
-            'val': {
-                'c_nc': {
-                    'sl': (value) & 0xff,
-                    'sh': (value >> 8) & 0xff
-                }
-            }
-        })
-        ret = lib.ddca_set_any_vcp_value(con, code, vcp_val)
-        print('write ret', ret)
-
-# lib.ddca_free_display_info_list(x[0])
\ No newline at end of file
+        if not 0 <= value <= 0xffff:
+            raise DDCError(DDCRC_ARG, f'0x{code:02x} = {value} (not 16 bit)')
+        # plain ints, no DDCA_Any_Vcp_Value to build
+        ret = self._tries(self.lib.DDCA_WRITE_ONLY_TRIES, self.lib.ddca_set_non_table_vcp_value,
+            con, code, (value >> 8) & 0xff, value & 0xff)
+        self._check(ret, 'ddca_set_non_table_vcp_value')
@@ -5,6 +5,8 @@ ffibuilder = FFI()
 # globals needed to use the shared object. It must be in valid C syntax.
 with open('ddcutil_gen.h', 'r') as header_file:
     ffibuilder.cdef(header_file.read())
+# strings returned by libddcutil have to be freed by the caller
+ffibuilder.cdef('void free(void *ptr);')
 
 # set_source() gives the name of the python extension module to
 # produce, and some C source code as a string.  This C code needs
@@ -12,6 +14,7 @@ with open('ddcutil_gen.h', 'r') as header_file:
 # so it is often just the "#include".
 ffibuilder.set_source("_ddc_cffi",
 """
+    #include <stdlib.h>
     #include "ddcutil_c_api.h"
     #include "ddcutil_types.h"
 """,
@@ -0,0 +1,500 @@
+import os
+import re
+import sys
+import time
+import random
+import threading
+from dataclasses import dataclass, field
+from collections import Counter, defaultdict
+from cffi import FFI
+from ddc_tray.ddc.interface import (DDCRC_REPORTED_UNSUPPORTED, DDCRC_RETRIES, DDCRC_ARG,
+    DDCRC_INVALID_DISPLAY, DDCRC_VERIFY)
+
+# ABI level ffi with the same declarations as the real binding, only used for types,
+# the functions are provided by SimLib in python
+ffi = FFI()
+with open(os.path.join(os.path.dirname(__file__), '..', 'ddcutil_cffi', 'ddcutil_gen.h')) as header_file:
+    ffi.cdef(header_file.read())
+
+# subset of the status codes from ddcutil_status_codes.h
+RC_NAMES = {
+    0: ('DDCRC_OK', 'Success'),
+    -5: ('EIO', 'Input/output error'),
+    DDCRC_REPORTED_UNSUPPORTED: ('DDCRC_REPORTED_UNSUPPORTED', 'Feature reported as unsupported'),
+    DDCRC_RETRIES: ('DDCRC_RETRIES', 'Maximum retries exceeded'),
+    DDCRC_ARG: ('DDCRC_ARG', 'Illegal argument'),
+    DDCRC_INVALID_DISPLAY: ('DDCRC_INVALID_DISPLAY', 'Invalid display'),
+    DDCRC_VERIFY: ('DDCRC_VERIFY', 'Read after write does not match value written'),
+}
+
+# every feature listed has a value in default_values()
+DEFAULT_CAPS = ('(prot(monitor)type(lcd)model({model})cmds(01 02 03 07 0C E3 F3)'
+    'vcp(10 12 14(05 06 08 0B) 16 18 1A 60(0F 11 12) 62 C9 D6(01 04 05) DF)mswhql(1)mccs_ver(2.1))')
+
+def default_values():
+    return {
+        0x10: [50, 100], # brightness
+        0x12: [75, 100], # contrast
+        0x14: [0x05, 0x0b], # color preset
+        0x16: [50, 100], 0x18: [50, 100], 0x1a: [50, 100], # rgb gains
+        0x60: [0x0f, 0x12], # input source
+        0x62: [30, 100], # volume
+        0xc9: [0x0102, 0], # firmware level
+        0xd6: [0x01, 0x05], # power mode
+        0xdf: [0x0201, 0], # vcp version
+    }
+
+def parse_vcp(caps: str) -> list:
+    '''[feature code, values or None] from the vcp() section of a capabilities string'''
+    features = []
+    depth = 0
+    for token in re.findall(r'[0-9A-Fa-f]+|\(|\)', caps[caps.index('vcp(') + 4:]):
+        if token == '(':
+            depth += 1
+            features[-1][1] = features[-1][1] or []
+        elif token == ')':
+            if depth == 0:
+                break
+            depth -= 1
+        elif depth == 0:
+            features.append([int(token, 16), None])
+        else:
+            features[-1][1].append(int(token, 16))
+    return features
+
+@dataclass
+class SimDisplay:
+    dispno: int
+    busno: int
+    mfg_id: str = 'SIM'
+    model: str = 'Virtual'
+    sn: str = ''
+    product_code: int = 0
+    # times in ms, scaled by SimLib.time_scale
+    open_ms: float = 15
+    close_ms: float = 5
+    xfer_ms: float = 5 # one i2c write or read on the wire
+    # ddc sleeps, scaled by the sleep multiplier of the calling thread
+    write_sleep_ms: float = 50
+    read_sleep_ms: float = 40
+    # sleeps below this multiplier make the monitor nak most of the time
+    min_multiplier: float = 0.3
+    nak_rate: float = 0.0
+    # writes that are acked but not applied, only visible with verify
+    drop_rate: float = 0.0
+    caps: str = DEFAULT_CAPS
+    values: dict = field(default_factory=default_values)
+
+    def edid(self) -> bytes:
+        mfg = [ord(c) - ord('A') + 1 for c in (self.mfg_id + 'AAA')[:3]]
+        edid = bytearray(128)
+        edid[0:8] = b'\x00\xff\xff\xff\xff\xff\xff\x00'
+        edid[8:10] = (mfg[0] << 10 | mfg[1] << 5 | mfg[2]).to_bytes(2, 'big')
+        edid[10:12] = self.product_code.to_bytes(2, 'little')
+        edid[12:16] = self.busno.to_bytes(4, 'little')
+        edid[18:20] = b'\x01\x04'
+        edid[54:72] = b'\x00\x00\x00\xfc\x00' + self.model.encode()[:13].ljust(13, b'\n')
+        edid[72:90] = b'\x00\x00\x00\xff\x00' + self.sn.encode()[:13].ljust(13, b'\n')
+        edid[127] = -sum(edid[:127]) & 0xff
+        return bytes(edid)
+
+class SimLib:
+    '''Stand-in for the cffi lib of libddcutil, simulating bus timing of N virtual monitors
+
+    Implements the subset of ddcutil_gen.h used by ddc_tray: display list, open/close,
+    non table vcp get/set, capabilities, sleep multiplier, retries, verify and stats.
+    '''
+    DDCA_NON_TABLE_VCP_VALUE = 1
+    DDCA_TABLE_VCP_VALUE = 2
+    DDCA_IO_I2C = 0
+    DDCA_WRITE_ONLY_TRIES = 0
+    DDCA_WRITE_READ_TRIES = 1
+    DDCA_MULTI_PART_TRIES = 2
+    DDCA_STATS_NONE = 0x00
+    DDCA_STATS_TRIES = 0x01
+    DDCA_STATS_ERRORS = 0x02
+    DDCA_STATS_CALLS = 0x04
+    DDCA_STATS_ELAPSED = 0x08
+    DDCA_STATS_ALL = 0xff
+    DDCA_CAPTURE_NOOPTS = 0
+    MAX_MAX_TRIES = 15
+
+    def __init__(self, monitors=2, time_scale=1.0, seed=None, displays=None, **display_args):
+        self.time_scale = time_scale
+        self.random = random.Random(seed)
+        self.displays = displays or [SimDisplay(dispno=i+1, busno=i+3, model=f'Virtual {i+1}',
+            sn=f'SIM{i+1:04}', product_code=0x1000+i, **display_args) for i in range(monitors)]
+        self.refs = {id(d): d for d in self.displays}
+        # like libddcutil, display refs are created by detection when the library
+        # starts. The display list and ddca_get_display_ref only know those
+        self.detected = list(self.displays)
+        self.handles = {}
+        # keep cffi allocations alive while the caller holds the pointers
+        self.allocs = {}
+        self.strings = {}
+        # transactions on one bus are serialized, like on a real i2c adapter
+        self.bus_locks = defaultdict(threading.Lock)
+        self.lock = threading.Lock()
+        self.next_handle = 1
+        # like libddcutil, sleep multiplier and verify are per thread, max tries global
+        self.default_multiplier = 1.0
+        self.max_tries = [4, 10, 8]
+        self.thread = threading.local()
+        self.capture = None
+        self.ddca_reset_stats()
+
+    @classmethod
+    def from_env(cls):
+        '''DDC_TRAY_SIM=<monitors>[,<time scale>] selects the simulated backend'''
+        spec = os.environ.get('DDC_TRAY_SIM')
+        if not spec:
+            return None
+        parts = spec.split(',')
+        return cls(monitors=int(parts[0]), time_scale=float(parts[1]) if len(parts) > 1 else 1.0)
+
+    # -- helpers
+
+    def _sleep(self, ms):
+        time.sleep(ms * self.time_scale / 1000)
+
+    def _keep(self, cdata, *deps):
+        with self.lock:
+            self.allocs[int(ffi.cast('uintptr_t', cdata))] = (cdata, deps)
+        return cdata
+
+    def _string(self, s):
+        with self.lock:
+            if s not in self.strings:
+                self.strings[s] = ffi.new('char[]', s.encode())
+            return self.strings[s]
+
+    def _display(self, dh):
+        d = self.handles.get(int(ffi.cast('uintptr_t', dh)))
+        return d if d in self.displays else None
+
+    def _thread(self):
+        t = self.thread
+        if not hasattr(t, 'multiplier'):
+            t.multiplier = self.default_multiplier
+            t.verify = False
+            t.error = None
+        return t
+
+    def _count(self, func, rc, start):
+        with self.lock:
+            self.calls[func] += 1
+            self.elapsed[func] += time.perf_counter() - start
+            if rc != 0:
+                self.errors[rc] += 1
+        self._thread().error = (rc, func) if rc != 0 else None
+        return rc
+
+    def _transaction(self, d, retry_type, sleep_ms, xfers=1):
+        '''one ddc exchange with retries, returns 0 or DDCRC_RETRIES'''
+        t = self._thread()
+        with self.bus_locks[d.busno]:
+            for tries in range(1, self.max_tries[retry_type] + 1):
+                self._sleep(d.xfer_ms * xfers + sleep_ms * t.multiplier)
+                fail = d.nak_rate
+                if t.multiplier < d.min_multiplier:
+                    fail = max(fail, 0.75)
+                if self.random.random() >= fail:
+                    with self.lock:
+                        self.tries[retry_type][tries] += 1
+                    return 0
+        with self.lock:
+            self.tries[retry_type][0] += 1
+        return DDCRC_RETRIES
+
+    def _out(self, text):
+        if self.capture is not None:
+            self.capture.append(text)
+        else:
+            sys.stdout.write(text)
+
+    def free(self, ptr):
+        with self.lock:
+            self.allocs.pop(int(ffi.cast('uintptr_t', ptr)), None)
+
+    # -- display list
+
+    def ddca_get_display_info_list2(self, include_invalid_displays, dlist_loc):
+        start = time.perf_counter()
+        displays = [d for d in self.detected if d in self.displays]
+        # probing every bus for a monitor
+        for d in displays:
+            with self.bus_locks[d.busno]:
+                self._sleep(d.xfer_ms * 4 + d.read_sleep_ms)
+        dlist = self._keep(ffi.new('DDCA_Display_Info_List *', {'info': len(displays)}))
+        dlist.ct = len(displays)
+        for i, d in enumerate(displays):
+            info = dlist.info[i]
+            info.marker = b'DDIN'
+            info.dispno = d.dispno
+            info.path.io_mode = self.DDCA_IO_I2C
+            info.path.path.i2c_busno = d.busno
+            info.mfg_id = d.mfg_id.encode()
+            info.model_name = d.model.encode()
+            info.sn = d.sn.encode()
+            info.product_code = d.product_code
+            info.edid_bytes = d.edid()
+            info.vcp_version = {'major': 2, 'minor': 1}
+            info.dref = ffi.cast('void *', id(d))
+        dlist_loc[0] = dlist
+        return self._count('ddca_get_display_info_list2', 0, start)
+
+    def ddca_free_display_info_list(self, dlist):
+        self.free(dlist)
+
+    def ddca_create_busno_display_identifier(self, busno, did_loc):
+        did_loc[0] = self._keep(ffi.new('int *', busno))
+        return 0
+
+    def ddca_free_display_identifier(self, did):
+        self.free(did)
+        return 0
+
+    def ddca_get_display_ref(self, did, dref_loc):
+        busno = ffi.cast('int *', did)[0]
+        for d in self.detected:
+            if d.busno == busno:
+                dref_loc[0] = ffi.cast('void *', id(d))
+                return 0
+        return DDCRC_INVALID_DISPLAY
+
+    # -- open/close
+
+    def ddca_open_display2(self, dref, wait, dh_loc):
+        start = time.perf_counter()
+        d = self.refs.get(int(ffi.cast('uintptr_t', dref)))
+        if d is None or d not in self.displays:
+            return self._count('ddca_open_display2', DDCRC_INVALID_DISPLAY, start)
+        with self.bus_locks[d.busno]:
+            self._sleep(d.open_ms)
+        with self.lock:
+            handle = self.next_handle
+            self.next_handle += 1
+            self.handles[handle] = d
+        dh_loc[0] = ffi.cast('void *', handle)
+        return self._count('ddca_open_display2', 0, start)
+
+    def ddca_close_display(self, dh):
+        start = time.perf_counter()
+        with self.lock:
+            d = self.handles.pop(int(ffi.cast('uintptr_t', dh)), None)
+        if d is None:
+            return self._count('ddca_close_display', DDCRC_ARG, start)
+        if d in self.displays:
+            with self.bus_locks[d.busno]:
+                self._sleep(d.close_ms)
+        return self._count('ddca_close_display', 0, start)
+
+    # -- vcp values
+
+    def _get(self, func, dh, code):
+        '''returns rc, [current, max]'''
+        start = time.perf_counter()
+        d = self._display(dh)
+        if d is None:
+            return self._count(func, DDCRC_ARG, start), None
+        rc = self._transaction(d, self.DDCA_WRITE_READ_TRIES, d.read_sleep_ms, xfers=2)
+        if rc == 0 and code not in d.values:
+            rc = DDCRC_REPORTED_UNSUPPORTED
+        return self._count(func, rc, start), d.values.get(code)
+
+    def ddca_get_any_vcp_value_using_explicit_type(self, dh, code, value_type, valrec_loc):
+        rc, value = self._get('ddca_get_any_vcp_value_using_explicit_type', dh, code)
+        if rc == 0:
+            cur, mx = value
+            val = self._keep(ffi.new('DDCA_Any_Vcp_Value *'))
+            val.opcode = code
+            val.value_type = value_type
+            val.val.c_nc = {'mh': mx >> 8, 'ml': mx & 0xff, 'sh': cur >> 8, 'sl': cur & 0xff}
+            valrec_loc[0] = val
+        return rc
+
+    def ddca_get_non_table_vcp_value(self, dh, code, valrec):
+        rc, value = self._get('ddca_get_non_table_vcp_value', dh, code)
+        if rc == 0:
+            cur, mx = value
+            valrec.mh, valrec.ml, valrec.sh, valrec.sl = mx >> 8, mx & 0xff, cur >> 8, cur & 0xff
+        return rc
+
+    def ddca_free_any_vcp_value(self, valrec):
+        self.free(valrec)
+
+    def _set(self, func, dh, code, value):
+        start = time.perf_counter()
+        d = self._display(dh)
+        if d is None:
+            return self._count(func, DDCRC_ARG, start)
+        if code not in d.values:
+            return self._count(func, DDCRC_REPORTED_UNSUPPORTED, start)
+        rc = self._transaction(d, self.DDCA_WRITE_ONLY_TRIES, d.write_sleep_ms)
+        if rc == 0 and self.random.random() >= d.drop_rate:
+            d.values[code][0] = value
+        if rc == 0 and self._thread().verify:
+            rc = self._transaction(d, self.DDCA_WRITE_READ_TRIES, d.read_sleep_ms, xfers=2)
+            if rc == 0 and d.values[code][0] != value:
+                rc = DDCRC_VERIFY
+        return self._count(func, rc, start)
+
+    def ddca_set_any_vcp_value(self, dh, code, valrec):
+        c_nc = valrec.val.c_nc
+        return self._set('ddca_set_any_vcp_value', dh, code, c_nc.sh << 8 | c_nc.sl)
+
+    def ddca_set_non_table_vcp_value(self, dh, code, hi_byte, lo_byte):
+        return self._set('ddca_set_non_table_vcp_value', dh, code, hi_byte << 8 | lo_byte)
+
+    def ddca_enable_verify(self, onoff):
+        t = self._thread()
+        old, t.verify = t.verify, bool(onoff)
+        return old
+
+    def ddca_is_verify_enabled(self):
+        return self._thread().verify
+
+    def ddca_get_mccs_version_by_dh(self, dh, vspec):
+        d = self._display(dh)
+        if d is None:
+            return DDCRC_ARG
+        vspec.major, vspec.minor = d.values[0xdf][0] >> 8, d.values[0xdf][0] & 0xff
+        return 0
+
+    # -- capabilities
+
+    def ddca_get_capabilities_string(self, dh, caps_loc):
+        start = time.perf_counter()
+        d = self._display(dh)
+        if d is None:
+            return self._count('ddca_get_capabilities_string', DDCRC_ARG, start)
+        caps = d.caps.format(model=d.model)
+        # multi part read, 32 bytes per fragment
+        for _ in range(0, len(caps), 32):
+            rc = self._transaction(d, self.DDCA_MULTI_PART_TRIES, d.read_sleep_ms, xfers=2)
+            if rc != 0:
+                return self._count('ddca_get_capabilities_string', rc, start)
+        caps_loc[0] = self._keep(ffi.new('char[]', caps.encode()))
+        return self._count('ddca_get_capabilities_string', 0, start)
+
+    def ddca_parse_capabilities_string(self, caps_string, parsed_loc):
+        caps = ffi.string(caps_string).decode()
+        features = parse_vcp(caps)
+        unparsed = ffi.new('char[]', caps.encode())
+        vcp_codes = ffi.new('DDCA_Cap_Vcp[]', len(features))
+        arrays = []
+        for i, (code, values) in enumerate(features):
+            vcp_codes[i].marker = b'CVCP'
+            vcp_codes[i].feature_code = code
+            vcp_codes[i].value_ct = len(values or [])
+            if values:
+                arrays.append(ffi.new('uint8_t[]', values))
+                vcp_codes[i].values = arrays[-1]
+        parsed = self._keep(ffi.new('DDCA_Capabilities *'), unparsed, vcp_codes, arrays)
+        parsed.marker = b'CAPA'
+        parsed.unparsed_string = unparsed
+        parsed.version_spec = {'major': 2, 'minor': 1}
+        parsed.vcp_code_ct = len(features)
+        parsed.vcp_codes = vcp_codes
+        parsed_loc[0] = parsed
+        return 0
+
+    def ddca_free_parsed_capabilities(self, parsed):
+        self.free(parsed)
+
+    # -- tuning, per thread like in libddcutil
+
+    def ddca_set_sleep_multiplier(self, multiplier):
+        t = self._thread()
+        old, t.multiplier = t.multiplier, multiplier
+        return old
+
+    def ddca_get_sleep_multiplier(self):
+        return self._thread().multiplier
+
+    def ddca_set_default_sleep_multiplier(self, multiplier):
+        old, self.default_multiplier = self.default_multiplier, multiplier
+        return old
+
+    def ddca_get_default_sleep_multiplier(self):
+        return self.default_multiplier
+
+    def ddca_max_max_tries(self):
+        return self.MAX_MAX_TRIES
+
+    def ddca_get_max_tries(self, retry_type):
+        return self.max_tries[retry_type]
+
+    def ddca_set_max_tries(self, retry_type, max_tries):
+        if not 1 <= max_tries <= self.MAX_MAX_TRIES:
+            return DDCRC_ARG
+        self.max_tries[retry_type] = max_tries
+        return 0
+
+    # -- errors and stats
+
+    def ddca_rc_name(self, rc):
+        return self._string(RC_NAMES.get(rc, (f'rc{rc}', ''))[0])
+
+    def ddca_rc_desc(self, rc):
+        return self._string(RC_NAMES.get(rc, ('', 'unknown status code'))[1])
+
+    def ddca_get_error_detail(self):
+        error = self._thread().error
+        if error is None:
+            return ffi.NULL
+        rc, func = error
+        text = ffi.new('char[]', f'{func}: {RC_NAMES.get(rc, ("", "unknown error"))[1]}'.encode())
+        detail = self._keep(ffi.new('DDCA_Error_Detail *', {'causes': 0}), text)
+        detail.marker = b'EDTL'
+        detail.status_code = rc
+        detail.detail = text
+        return detail
+
+    def ddca_free_error_detail(self, detail):
+        self.free(detail)
+
+    def ddca_reset_stats(self):
+        with self.lock:
+            self.tries = [Counter(), Counter(), Counter()]
+            self.errors = Counter()
+            self.calls = Counter()
+            self.elapsed = Counter()
+
+    def ddca_show_stats(self, stats, include_per_thread_data, depth):
+        names = ['Write only exchange tries', 'Write read exchange tries', 'Multi-part exchange tries']
+        indent = '   ' * depth
+        lines = []
+        with self.lock:
+            if stats & self.DDCA_STATS_TRIES:
+                for name, counter in zip(names, self.tries):
+                    hist = ', '.join(f'{k}: {counter[k]}' for k in sorted(counter) if k)
+                    lines.append(f'{name}: [{hist}] failed: {counter[0]}')
+            if stats & self.DDCA_STATS_ERRORS:
+                for rc, count in sorted(self.errors.items()):
+                    lines.append(f'Error {RC_NAMES.get(rc, (rc,))[0]}: {count}')
+            if stats & self.DDCA_STATS_CALLS:
+                for func, count in sorted(self.calls.items()):
+                    lines.append(f'Calls {func}: {count}')
+            if stats & self.DDCA_STATS_ELAPSED:
+                for func, secs in sorted(self.elapsed.items()):
+                    lines.append(f'Elapsed {func}: {secs*1000:.3f} ms')
+        self._out(''.join(f'{indent}{line}\n' for line in lines))
+
+    def ddca_start_capture(self, flags):
+        self.capture = []
+
+    def ddca_end_capture(self):
+        text, self.capture = ''.join(self.capture or []), None
+        return self._keep(ffi.new('char[]', text.encode()))
+
+    # -- hotplug, not part of libddcutil
+
+    def unplug(self, dispno):
+        with self.lock:
+            self.displays = [d for d in self.displays if d.dispno != dispno]
+
+    def plug(self, display: SimDisplay):
+        with self.lock:
+            self.displays = self.displays + [display]
+            self.refs[id(display)] = display
@@ -0,0 +1,73 @@
+import os
+import glob
+import threading
+
+class HotplugWatcher:
+    '''Watches DRM connectors and /dev/i2c-* for monitors being plugged or unplugged
+
+    Polls instead of using inotify, sysfs attributes like the connector status
+    raise no inotify events and udev would be an extra dependency. A poll only
+    reads a few small files. Roots can point to a fake tree for testing.
+    '''
+    def __init__(self, on_change, interval=2.0, sysfs_root='/sys', dev_root='/dev'):
+        # called as on_change(added, removed) from the watcher thread,
+        # added maps i2c bus to EDID bytes, removed is a list of buses
+        self.on_change = on_change
+        self.interval = interval
+        self.sysfs_root = sysfs_root
+        self.dev_root = dev_root
+        self.state = self.scan()
+        # poll() runs from the watcher thread and from callers that want to catch up
+        self.lock = threading.Lock()
+        self.stop_event = threading.Event()
+        self.thread = None
+
+    def _read(self, path, mode='r'):
+        try:
+            with open(path, mode) as f:
+                return f.read()
+        except OSError:
+            return None
+
+    def _bus(self, connector):
+        # i2c adapter of the connector: 'ddc' symlink, or an i2c-N child for DP aux channels
+        ddc = os.path.join(connector, 'ddc')
+        names = [os.path.basename(os.path.realpath(ddc))] if os.path.lexists(ddc) else []
+        names += [os.path.basename(p) for p in glob.glob(os.path.join(connector, 'i2c-*'))]
+        for name in names:
+            if name.startswith('i2c-') and name[4:].isdigit():
+                return int(name[4:])
+        return None
+
+    def scan(self) -> dict:
+        '''i2c bus -> EDID of every connected connector with an i2c device node'''
+        buses = {}
+        for connector in glob.glob(os.path.join(self.sysfs_root, 'class', 'drm', 'card*-*')):
+            if (self._read(os.path.join(connector, 'status')) or '').strip() != 'connected':
+                continue
+            bus = self._bus(connector)
+            if bus is not None and os.path.exists(os.path.join(self.dev_root, f'i2c-{bus}')):
+                buses[bus] = (self._read(os.path.join(connector, 'edid'), 'rb') or b'')[:128]
+        return buses
+
+    def poll(self):
+        '''(added, removed) since the last poll, a changed EDID counts as added'''
+        with self.lock:
+            new = self.scan()
+            added = {bus: edid for bus, edid in new.items() if self.state.get(bus) != edid}
+            removed = [bus for bus in self.state if bus not in new]
+            self.state = new
+            return added, removed
+
+    def _loop(self):
+        while not self.stop_event.wait(self.interval):
+            added, removed = self.poll()
+            if added or removed:
+                self.on_change(added, removed)
+
+    def start(self):
+        self.thread = threading.Thread(target=self._loop, name='ddc-hotplug', daemon=True)
+        self.thread.start()
+
+    def stop(self):
+        self.stop_event.set()
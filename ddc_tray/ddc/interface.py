@@ -1,4 +1,5 @@
-from dataclasses import dataclass
+import hashlib
+from dataclasses import dataclass, field
 from abc import ABC, abstractmethod
 from typing import TypeVar
 from enum import Enum, auto
@@ -6,6 +7,13 @@ from enum import Enum, auto
 DisplayRef = TypeVar('display reference') # opaque data/pointer
 DisplayCon = TypeVar('open display connection') # opaque data/pointer
 
+# libddcutil status codes used here, from ddcutil_status_codes.h
+DDCRC_REPORTED_UNSUPPORTED = -3005
+DDCRC_RETRIES = -3010
+DDCRC_ARG = -3013
+DDCRC_INVALID_DISPLAY = -3020
+DDCRC_VERIFY = -3023
+
 @dataclass
 class Monitor:
     display_idx: int
@@ -13,19 +21,69 @@ class Monitor:
     model: str
     manufacturer: str
     vcp_ver: str
+    bus: int = -1 # i2c bus number, -1 if not connected via i2c
+    sn: str = ''
+    edid: bytes = field(default=b'', repr=False)
 
     def __str__(self):
         return f'{self.display_idx}: [{self.manufacturer}] {self.model}'
 
+    @property
+    def edid_key(self) -> str:
+        # stable id of the physical monitor, used to persist per monitor data
+        return hashlib.sha1(self.edid).hexdigest()[:16]
+
 @dataclass
 class VCP_result:
     value: int
     max: int
 
+def parse_edid(edid: bytes):
+    '''(manufacturer id, model name, serial number) from a 128 byte EDID'''
+    if len(edid) < 128:
+        return '', '', ''
+    mfg_code = int.from_bytes(edid[8:10], 'big')
+    mfg = ''.join(chr(ord('A') - 1 + (mfg_code >> shift & 0x1f)) for shift in (10, 5, 0))
+    model = sn = ''
+    # 4 descriptor blocks of 18 bytes, 0xfc holds the name and 0xff the serial
+    for i in range(54, 126, 18):
+        block = edid[i:i+18]
+        if block[0:3] == b'\0\0\0' and block[3] in (0xfc, 0xff):
+            text = block[5:18].split(b'\n')[0].decode('ascii', 'replace').strip()
+            if block[3] == 0xfc:
+                model = text
+            else:
+                sn = text
+    return mfg, model, sn
+
+@dataclass
+class Capabilities:
+    raw: str
+    mccs_ver: str
+    # feature code -> declared values, empty for continuous features
+    features: dict[int, list[int]]
+
+    def supports(self, code: int) -> bool:
+        return code in self.features
+
+class DDCError(Exception):
+    def __init__(self, code: int, msg: str = ''):
+        super().__init__(f'{msg} failed with code {code}')
+        self.code = code
+        self.msg = msg
+
 
 class DDC_Interface(ABC):
     class VCP(Enum):
         BRIGHTNESS = 0x10
+        CONTRAST = 0x12
+        RED_GAIN = 0x16
+        GREEN_GAIN = 0x18
+        BLUE_GAIN = 0x1A
+        INPUT_SOURCE = 0x60
+        VOLUME = 0x62
+        FIRMWARE_LEVEL = 0xC9
+        POWER_MODE = 0xD6
 
     @abstractmethod
     def get_monitors() -> list[Monitor]:
@@ -42,4 +100,14 @@ class DDC_Interface(ABC):
 
     @abstractmethod
     def write_vcp(con: DisplayCon, code: int, value: int):
-        pass
\ No newline at end of file
+        pass
+
+    def read_vcp_many(self, con: DisplayCon, codes: list[int]) -> dict:
+        '''code -> VCP_result, or the DDCError of that feature, all on one open connection'''
+        results = {}
+        for code in codes:
+            try:
+                results[code] = self.read_vcp(con, code)
+            except DDCError as e:
+                results[code] = e
+        return results
\ No newline at end of file
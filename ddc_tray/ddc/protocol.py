@@ -0,0 +1,35 @@
+import os
+from ddc_tray.ddc.interface import Monitor
+
+# Protocol: one JSON array per line in both directions.
+#   request   [id, op, *args]
+#   response  [id, 0, result]  or  [id, rc, message] with the DDCRC_* code or -1
+# Requests on one connection run concurrently, responses come in completion
+# order, matched by id. Monitors are addressed by their registry id.
+#
+#   ls                          -> [monitor, ...]
+#   sync                        -> [monitor, ...] after applying pending hotplug changes
+#   get   id code               -> [value, max]
+#   many  id [code, ...]        -> {code: [value, max] or [rc, message]}
+#   set   id code value         -> null
+#   caps  id                    -> [raw, mccs_ver, {code: [values]}]
+#   stats                       -> telemetry snapshot, retry limits, verifier counters
+
+def socket_path() -> str:
+    runtime = os.environ.get('XDG_RUNTIME_DIR')
+    if runtime:
+        return os.path.join(runtime, 'ddc-tray.sock')
+    return f'/tmp/ddc-tray-{os.getuid()}.sock'
+
+def monitor_to_json(mon: Monitor, uid: str) -> dict:
+    return {'id': uid, 'idx': mon.display_idx, 'model': mon.model, 'mfg': mon.manufacturer,
+        'vcp': mon.vcp_ver, 'bus': mon.bus, 'sn': mon.sn, 'edid': mon.edid.hex(),
+        'detected': mon.display_ref is not None}
+
+def monitor_from_json(data: dict) -> Monitor:
+    # the registry id stands in for the display ref on the client side,
+    # a monitor libddcutil did not detect has none
+    return Monitor(display_idx=data['idx'], display_ref=data['id'] if data.get('detected', True) else None,
+        model=data['model'],
+        manufacturer=data['mfg'], vcp_ver=data['vcp'], bus=data['bus'], sn=data['sn'],
+        edid=bytes.fromhex(data['edid']))
@@ -0,0 +1,68 @@
+import threading
+from ddc_tray.ddc.interface import Monitor
+
+def monitor_ids(monitors: list[Monitor]) -> dict:
+    '''stable id -> Monitor, the EDID key, with the bus appended for a second
+    monitor with an identical EDID, assigned in display order'''
+    by_id = {}
+    for mon in sorted(monitors, key=lambda mon: (mon.display_idx, mon.bus)):
+        key = mon.edid_key
+        by_id[key if key not in by_id else f'{key}@{mon.bus}'] = mon
+    return by_id
+
+class MonitorRegistry:
+    '''Monitors by stable id across rescans
+
+    Ids are those of monitor_ids(). A monitor seen again keeps its Monitor object, only the
+    fields from the new scan are copied into it, so callers can hold on to it.
+    Lookups by id, display number, bus and display ref are dict lookups.
+    '''
+    def __init__(self):
+        self.lock = threading.Lock()
+        # ordered by display number
+        self.monitors = []
+        self.by_id = {}
+        self.by_dispno = {}
+        self.by_bus = {}
+        self.by_ref = {}
+        self.ids = {}
+
+    def replace(self, found: list[Monitor]):
+        '''make found the current set, returns (added, removed) Monitor lists'''
+        with self.lock:
+            by_id = monitor_ids(found)
+            for uid, mon in by_id.items():
+                prev = self.by_id.get(uid)
+                if prev is not None:
+                    prev.__dict__.update(mon.__dict__)
+                    by_id[uid] = prev
+            added = [mon for uid, mon in by_id.items() if uid not in self.by_id]
+            removed = [mon for uid, mon in self.by_id.items() if uid not in by_id]
+            self.by_id = by_id
+            self.ids = {id(mon): uid for uid, mon in by_id.items()}
+            self.monitors = sorted(by_id.values(), key=lambda mon: mon.display_idx)
+            self.by_dispno = {mon.display_idx: mon for mon in self.monitors}
+            self.by_bus = {mon.bus: mon for mon in self.monitors if mon.bus >= 0}
+            self.by_ref = {mon.display_ref: mon for mon in self.monitors if mon.display_ref is not None}
+            return added, removed
+
+    def id_of(self, mon: Monitor):
+        return self.ids.get(id(mon))
+
+    def get(self, uid: str):
+        return self.by_id.get(uid)
+
+    def dispno(self, n: int):
+        return self.by_dispno.get(n)
+
+    def bus(self, n: int):
+        return self.by_bus.get(n)
+
+    def ref(self, dref):
+        return self.by_ref.get(dref)
+
+    def __iter__(self):
+        return iter(self.monitors)
+
+    def __len__(self):
+        return len(self.monitors)
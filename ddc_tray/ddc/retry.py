@@ -0,0 +1,154 @@
+import time
+import threading
+from collections import deque
+from ddc_tray.ddc.interface import Monitor, DDCRC_RETRIES
+
+class RetryStats:
+    def __init__(self, window, history):
+        # estimated tries of recent successful calls
+        self.tries = deque(maxlen=history)
+        self.latency = deque(maxlen=window)
+        self.failed = deque(maxlen=window)
+        self.limit = None
+        # calls left with a raised limit, and the failures seen under it
+        self.boost = 0
+        self.boost_failed = 0
+        # calls left before another raise, after one that did not help
+        self.cooldown = 0
+        # time.monotonic() of the last call observed
+        self.last = 0.0
+
+class RetryPolicy:
+    '''Max tries per retry type, just above what calls on any display needed
+
+    libddcutil does not report the tries of a call, they are estimated from the
+    latency: a call that needed N tries takes about N times as long as the
+    fastest recent call. The limit is the given percentile of the estimated
+    tries plus a margin. When more than the spike fraction of recent calls ran
+    out of tries the limit is doubled for the next hold calls. If calls keep
+    failing with the doubled limit the display is off rather than flaky, the
+    raise is dropped and not tried again for hold calls.
+
+    Tries are tracked per display, but ddca_set_max_tries is process wide, so
+    the limit set is the highest one of the displays with min_samples calls or
+    a raise, among those called in the last recent seconds. Displays the
+    registry removed are forgotten. The limit is set right before a
+    call if it changed, under lock, the process wide lock of everything that
+    changes max tries. While someone else holds it (a calibration) the limit
+    is left alone.
+    '''
+    def __init__(self, lib, percentile=0.99, margin=1, min_tries=2, min_samples=20, window=50,
+            history=500, spike=0.1, hold=100, recent=600.0, lock=None):
+        self.lib = lib
+        self.max_tries_lock = lock or threading.Lock()
+        self.percentile = percentile
+        self.margin = margin
+        self.min_tries = min_tries
+        self.min_samples = min_samples
+        self.window = window
+        self.history = history
+        self.spike = spike
+        self.hold = hold
+        self.recent = recent
+        self.max_tries = lib.ddca_max_max_tries()
+        retry_types = (lib.DDCA_WRITE_ONLY_TRIES, lib.DDCA_WRITE_READ_TRIES, lib.DDCA_MULTI_PART_TRIES)
+        # libddcutil defaults, used until a display has enough samples
+        self.defaults = {t: lib.ddca_get_max_tries(t) for t in retry_types}
+        # (edid key, retry type) -> RetryStats
+        self.stats_by = {}
+        # retry type -> limit of the process, and the one last set in libddcutil
+        self.limits = dict(self.defaults)
+        self.applied = dict(self.defaults)
+        self.lock = threading.Lock()
+
+    def _stats(self, mon: Monitor, retry_type: int) -> RetryStats:
+        key = (mon.edid_key, retry_type)
+        stats = self.stats_by.get(key)
+        if stats is None:
+            stats = self.stats_by[key] = RetryStats(self.window, self.history)
+        return stats
+
+    def _limit(self, stats: RetryStats, retry_type: int) -> int:
+        if len(stats.tries) < self.min_samples:
+            limit = self.defaults[retry_type]
+        else:
+            tries = sorted(stats.tries)[int(self.percentile * (len(stats.tries) - 1))]
+            limit = max(self.min_tries, tries + self.margin)
+        if stats.boost:
+            limit *= 2
+        return min(limit, self.max_tries)
+
+    def _update(self, retry_type: int):
+        # displays without enough samples would only ever pin the default
+        since = time.monotonic() - self.recent
+        limits = [s.limit for (_, t), s in self.stats_by.items() if t == retry_type and s.limit
+            and s.last > since and (len(s.tries) >= self.min_samples or s.boost)]
+        self.limits[retry_type] = max(limits, default=self.defaults[retry_type])
+
+    def forget(self, mon: Monitor):
+        '''drop the stats of a display that is gone'''
+        with self.lock:
+            for key in [key for key in self.stats_by if key[0] == mon.edid_key]:
+                del self.stats_by[key]
+            for retry_type in self.limits:
+                self._update(retry_type)
+
+    def before(self, mon: Monitor, retry_type: int):
+        '''set the process wide limit if it changed since it was last set'''
+        with self.lock:
+            stats = self._stats(mon, retry_type)
+            if stats.limit is None:
+                stats.limit = self._limit(stats, retry_type)
+                self._update(retry_type)
+            limit = self.limits[retry_type]
+            if self.applied[retry_type] == limit:
+                return
+        if not self.max_tries_lock.acquire(blocking=False):
+            return
+        try:
+            with self.lock:
+                limit = self.limits[retry_type]
+                if self.applied[retry_type] == limit:
+                    return
+                self.lib.ddca_set_max_tries(retry_type, limit)
+                self.applied[retry_type] = limit
+        finally:
+            self.max_tries_lock.release()
+
+    def observe(self, mon: Monitor, retry_type: int, elapsed: float, rc: int):
+        if rc not in (0, DDCRC_RETRIES):
+            # unsupported feature, invalid display, ... say nothing about the bus
+            return
+        with self.lock:
+            stats = self._stats(mon, retry_type)
+            stats.last = time.monotonic()
+            # the call ran under the limit last set, whichever display it came from
+            limit = self.applied[retry_type]
+            failed = rc != 0
+            if not failed:
+                stats.latency.append(elapsed)
+                tries = max(1, round(elapsed / max(min(stats.latency), 1e-9)))
+                stats.tries.append(min(tries, limit))
+            stats.failed.append(failed)
+            if stats.cooldown:
+                stats.cooldown -= 1
+            if stats.boost:
+                stats.boost -= 1
+                stats.boost_failed += failed
+                if self.hold - stats.boost >= 10 and stats.boost_failed * 2 > self.hold - stats.boost:
+                    stats.boost = 0
+                    stats.cooldown = self.hold
+            elif not stats.cooldown and len(stats.failed) >= 10 \
+                    and sum(stats.failed) > self.spike * len(stats.failed):
+                stats.boost = self.hold
+                stats.boost_failed = 0
+                stats.failed.clear()
+            stats.limit = self._limit(stats, retry_type)
+            self._update(retry_type)
+
+    def stats(self):
+        with self.lock:
+            stats = {f'{key}/{retry_type}': {'limit': s.limit, 'boosted': bool(s.boost),
+                'max_seen': max(s.tries, default=None)} for (key, retry_type), s in self.stats_by.items()}
+            stats['applied'] = dict(self.applied)
+            return stats
@@ -0,0 +1,79 @@
+import threading
+from concurrent.futures import ThreadPoolExecutor
+from ddc_tray.ddc.interface import DDC_Interface, Monitor
+
+class CoalescingWriter:
+    '''Latest value wins write queue in front of DDC.write_vcp
+
+    While a write to a (monitor, code) pair is in flight only the newest pending
+    value is kept, so a burst of N writes costs at most two bus transactions.
+    '''
+    def __init__(self, ddc: DDC_Interface, executor_for=None, on_result=None, cache=None, verifier=None):
+        self.ddc = ddc
+        # VCPCache to keep up to date with the values written
+        self.cache = cache
+        # WriteVerifier to read back the settled values
+        self.verifier = verifier
+        self.own_executor = None
+        if executor_for is None:
+            self.own_executor = ThreadPoolExecutor(max_workers=1, thread_name_prefix='ddc-write')
+            executor_for = lambda mon: self.own_executor
+        self.executor_for = executor_for
+        # called as on_result(mon, code, value, error) from the worker after each bus write
+        self.on_result = on_result
+        self.pending = {}
+        self.in_flight = set()
+        self.lock = threading.Condition()
+        self.issued = 0
+        self.coalesced = 0
+
+    def write(self, mon: Monitor, code: int, value: int):
+        key = (mon.display_ref, code)
+        with self.lock:
+            if key in self.in_flight:
+                if key in self.pending:
+                    self.coalesced += 1
+                self.pending[key] = value
+                return
+            self.in_flight.add(key)
+            self.issued += 1
+        self.executor_for(mon).submit(self._run, mon, code, value)
+
+    def _run(self, mon: Monitor, code: int, value: int):
+        key = (mon.display_ref, code)
+        while True:
+            error = None
+            try:
+                with self.ddc.open_monitor(mon) as m:
+                    self.ddc.write_vcp(m, code, value)
+            except Exception as e:
+                error = e
+            if self.cache:
+                if error:
+                    self.cache.invalidate(mon, code)
+                else:
+                    self.cache.update(mon, code, value)
+            if self.verifier and not error:
+                self.verifier.written(mon, code, value)
+            if self.on_result:
+                self.on_result(mon, code, value, error)
+            with self.lock:
+                if key not in self.pending:
+                    self.in_flight.discard(key)
+                    self.lock.notify_all()
+                    return
+                value = self.pending.pop(key)
+                self.issued += 1
+
+    def join(self, timeout=None):
+        '''wait until all queued values have been written'''
+        with self.lock:
+            return self.lock.wait_for(lambda: not self.in_flight, timeout)
+
+    def stats(self):
+        with self.lock:
+            return {'issued': self.issued, 'coalesced': self.coalesced}
+
+    def close(self):
+        if self.own_executor:
+            self.own_executor.shutdown(wait=True)
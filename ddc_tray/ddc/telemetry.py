@@ -0,0 +1,165 @@
+import os
+import re
+import json
+import time
+import bisect
+import threading
+from collections import Counter
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+HEADER = os.path.join(os.path.dirname(__file__), 'ddcutil_cffi', 'ddcutil_gen.h')
+# latency histogram bucket bounds in ms, prometheus style cumulative on export
+BUCKETS_MS = (0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500)
+
+def status_functions(header=HEADER):
+    '''names of the ddca_ functions returning a DDCA_Status'''
+    with open(header) as f:
+        return set(re.findall(r'^\s*DDCA_Status\s+(ddca_\w+)\s*\(', f.read(), re.M))
+
+class Telemetry:
+    '''Latency histograms and return codes of every ddca_* call
+
+    instrument() wraps a lib so each call is timed. For functions returning a
+    DDCA_Status the code is counted, named with ddca_rc_name, and a failure
+    fetches the ddca_get_error_detail text of the calling thread.
+    '''
+    def __init__(self, ffi, lib, buckets=BUCKETS_MS):
+        self.ffi = ffi
+        self.lib = lib
+        self.buckets = buckets
+        self.status = status_functions()
+        self.lock = threading.Lock()
+        # function -> [bucket counts (+inf last), sum in ms, count]
+        self.latency = {}
+        # (function, rc) -> calls
+        self.codes = Counter()
+        # (function, rc) -> last error detail text
+        self.details = {}
+        self.names = {}
+        self.server = None
+
+    def instrument(self, lib):
+        return InstrumentedLib(lib, self)
+
+    def rc_name(self, rc: int) -> str:
+        name = self.names.get(rc)
+        if name is None:
+            name = self.names[rc] = self.ffi.string(self.lib.ddca_rc_name(rc)).decode()
+        return name
+
+    def _detail(self):
+        detail = self.lib.ddca_get_error_detail()
+        if detail == self.ffi.NULL:
+            return None
+        try:
+            return self.ffi.string(detail.detail).decode(errors='replace') if detail.detail else ''
+        finally:
+            self.lib.ddca_free_error_detail(detail)
+
+    def record(self, func: str, elapsed_ms: float, rc=None):
+        detail = self._detail() if rc else None
+        with self.lock:
+            hist = self.latency.get(func)
+            if hist is None:
+                hist = self.latency[func] = [[0] * (len(self.buckets) + 1), 0.0, 0]
+            hist[0][bisect.bisect_left(self.buckets, elapsed_ms)] += 1
+            hist[1] += elapsed_ms
+            hist[2] += 1
+            if rc is not None:
+                self.codes[(func, rc)] += 1
+            if detail is not None:
+                self.details[(func, rc)] = detail
+
+    def snapshot(self) -> dict:
+        with self.lock:
+            latency = {func: {'buckets': dict(zip([*map(str, self.buckets), '+Inf'], hist[0])),
+                'sum_ms': hist[1], 'count': hist[2]} for func, hist in self.latency.items()}
+            codes = list(self.codes.items())
+            details = dict(self.details)
+        return {
+            'time': time.time(),
+            'latency_ms': latency,
+            'return_codes': [{'function': func, 'rc': rc, 'name': self.rc_name(rc), 'count': n,
+                'detail': details.get((func, rc))} for (func, rc), n in codes],
+        }
+
+    def prometheus(self) -> str:
+        snap = self.snapshot()
+        lines = ['# HELP ddc_call_duration_ms libddcutil call latency',
+            '# TYPE ddc_call_duration_ms histogram']
+        for func, hist in snap['latency_ms'].items():
+            total = 0
+            for le, n in hist['buckets'].items():
+                total += n
+                lines.append(f'ddc_call_duration_ms_bucket{{function="{func}",le="{le}"}} {total}')
+            lines.append(f'ddc_call_duration_ms_sum{{function="{func}"}} {hist["sum_ms"]:.3f}')
+            lines.append(f'ddc_call_duration_ms_count{{function="{func}"}} {hist["count"]}')
+        lines += ['# HELP ddc_call_status_total libddcutil calls by DDCA_Status',
+            '# TYPE ddc_call_status_total counter']
+        for c in snap['return_codes']:
+            lines.append(f'ddc_call_status_total{{function="{c["function"]}",rc="{c["rc"]}",'
+                f'name="{c["name"]}"}} {c["count"]}')
+        return '\n'.join(lines) + '\n'
+
+    def write_textfile(self, path: str):
+        '''for the node_exporter textfile collector, replaced atomically'''
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        tmp = f'{path}.tmp'
+        with open(tmp, 'w') as f:
+            f.write(self.prometheus())
+        os.replace(tmp, path)
+
+    def serve(self, port: int, host='127.0.0.1'):
+        '''/metrics.json and /metrics on a local port, from a daemon thread'''
+        telemetry = self
+        class Handler(BaseHTTPRequestHandler):
+            def do_GET(self):
+                if self.path == '/metrics.json':
+                    body, ctype = json.dumps(telemetry.snapshot()).encode(), 'application/json'
+                elif self.path == '/metrics':
+                    body, ctype = telemetry.prometheus().encode(), 'text/plain; version=0.0.4'
+                else:
+                    self.send_error(404)
+                    return
+                self.send_response(200)
+                self.send_header('Content-Type', ctype)
+                self.send_header('Content-Length', str(len(body)))
+                self.end_headers()
+                self.wfile.write(body)
+
+            def log_message(self, *args):
+                pass
+
+        self.server = ThreadingHTTPServer((host, port), Handler)
+        threading.Thread(target=self.server.serve_forever, name='ddc-metrics', daemon=True).start()
+        return self.server.server_address[1]
+
+    def close(self):
+        if self.server:
+            self.server.shutdown()
+            self.server.server_close()
+            self.server = None
+
+class InstrumentedLib:
+    '''lib proxy, ddca_* functions are timed, everything else passes through'''
+    def __init__(self, lib, telemetry: Telemetry):
+        self._lib = lib
+        self._telemetry = telemetry
+
+    def __getattr__(self, name):
+        attr = getattr(self._lib, name)
+        if name.startswith('ddca_') and callable(attr):
+            attr = self._wrap(name, attr, name in self._telemetry.status)
+        # cached on the proxy, later lookups skip __getattr__
+        setattr(self, name, attr)
+        return attr
+
+    def _wrap(self, name, fn, status):
+        record = self._telemetry.record
+        perf_counter = time.perf_counter
+        def call(*args):
+            start = perf_counter()
+            ret = fn(*args)
+            record(name, (perf_counter() - start) * 1000, ret if status else None)
+            return ret
+        return call
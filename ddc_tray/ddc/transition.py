@@ -0,0 +1,154 @@
+import time
+import threading
+from concurrent.futures import Future
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, DDCError
+from ddc_tray.ddc.workers import IOPool
+
+class Transition:
+    def __init__(self, start_value: int, target: int, duration: float):
+        self.future = Future()
+        self.retarget(start_value, target, duration)
+
+    def retarget(self, start_value: int, target: int, duration: float):
+        self.start_value = start_value
+        self.target = target
+        self.duration = duration
+        self.t0 = time.perf_counter()
+
+    def value_at(self, now: float) -> int:
+        frac = min(1.0, (now - self.t0) / self.duration) if self.duration > 0 else 1.0
+        return round(self.start_value + (self.target - self.start_value) * frac)
+
+class TransitionEngine:
+    '''Smooth VCP value changes paced by the measured write latency of each display
+
+    Intermediate values are computed from the clock when the previous write
+    finished, so a slow display skips steps instead of queueing them, and a
+    frame whose value did not change writes nothing. Each frame is one task on
+    the worker of the display, the wait for the next one happens on a timer
+    thread, so reads and writes of other callers run in between. A transition
+    only ends after the target was written. Starting a new transition for a
+    running (display, code) pair retargets it from the last written value.
+    '''
+    def __init__(self, ddc: DDC_Interface, pool: IOPool, cache=None, duration=0.4, min_frame=0.02,
+            verifier=None):
+        self.ddc = ddc
+        self.pool = pool
+        self.cache = cache
+        # only the target is verified, intermediate steps are not
+        self.verifier = verifier
+        self.duration = duration
+        # never write faster than this, even if the display acks quicker
+        self.min_frame = min_frame
+        # display_ref -> moving average of write latency in seconds
+        self.latency = {}
+        self.active = {}
+        self.lock = threading.Lock()
+        # (display ref, code) -> (perf_counter() of the next frame, mon, code, transition)
+        self.due = {}
+        self.timer = threading.Condition()
+        self.running = True
+        self.thread = threading.Thread(target=self._loop, name='ddc-transition', daemon=True)
+        self.thread.start()
+
+    def write_latency(self, mon: Monitor):
+        return self.latency.get(mon.display_ref)
+
+    def start(self, mon: Monitor, code: int, target: int, start_value=None, duration=None) -> Future:
+        '''resolves to the number of writes issued once the target landed'''
+        key = (mon.display_ref, code)
+        duration = self.duration if duration is None else duration
+        with self.lock:
+            tr = self.active.get(key)
+            if tr is not None:
+                tr.retarget(tr.start_value if tr.last is None else tr.last, target, duration)
+                return tr.future
+            tr = Transition(start_value, target, duration)
+            # last value written or read, None until the first frame
+            tr.last = start_value
+            tr.writes = 0
+            self.active[key] = tr
+        self.pool.submit(mon, self._frame, mon, code, tr)
+        return tr.future
+
+    def _loop(self):
+        with self.timer:
+            while self.running:
+                now = time.perf_counter()
+                due = [key for key, d in self.due.items() if d[0] <= now]
+                for key in due:
+                    _, mon, code, tr = self.due.pop(key)
+                    self.pool.submit(mon, self._frame, mon, code, tr)
+                timeout = min((d[0] for d in self.due.values()), default=now + 60) - now
+                self.timer.wait(max(timeout, 0))
+
+    def _schedule(self, mon: Monitor, code: int, tr: Transition, when: float):
+        with self.timer:
+            self.due[(mon.display_ref, code)] = (when, mon, code, tr)
+            self.timer.notify()
+
+    def _write(self, mon, code, value):
+        start = time.perf_counter()
+        with self.ddc.open_monitor(mon) as m:
+            self.ddc.write_vcp(m, code, value)
+        elapsed = time.perf_counter() - start
+        prev = self.latency.get(mon.display_ref)
+        self.latency[mon.display_ref] = elapsed if prev is None else 0.7 * prev + 0.3 * elapsed
+        if self.cache:
+            self.cache.update(mon, code, value)
+
+    def _frame(self, mon: Monitor, code: int, tr: Transition):
+        '''one step on the worker of the display, schedules the next one'''
+        key = (mon.display_ref, code)
+        try:
+            if tr.start_value is None:
+                if self.cache:
+                    current = self.cache.read(mon, code).value
+                else:
+                    with self.ddc.open_monitor(mon) as m:
+                        current = self.ddc.read_vcp(m, code).value
+                with self.lock:
+                    if tr.start_value is None:
+                        tr.retarget(current, tr.target, tr.duration)
+                        tr.last = current
+            frame_start = time.perf_counter()
+            with self.lock:
+                value, target = tr.value_at(frame_start), tr.target
+                last = tr.last
+                if last != target and abs(target - value) >= abs(target - last):
+                    # the first step moves off the current value right away,
+                    # later frames that do not get closer to the target are skipped
+                    value = last + (1 if target > last else -1) if tr.writes == 0 else None
+            if value is not None and value != last:
+                try:
+                    self._write(mon, code, value)
+                    tr.writes += 1
+                    with self.lock:
+                        tr.last = value
+                except DDCError:
+                    # a lost intermediate step is fine, the target is not
+                    if value == target:
+                        raise
+            with self.lock:
+                done = tr.last == tr.target
+                if done:
+                    del self.active[key]
+            if not done:
+                frame = max(self.min_frame, self.latency.get(mon.display_ref, 0))
+                self._schedule(mon, code, tr, frame_start + frame)
+                return
+        except Exception as e:
+            with self.lock:
+                self.active.pop(key, None)
+            tr.future.set_exception(e)
+            return
+        if self.verifier and tr.writes:
+            self.verifier.written(mon, code, tr.target)
+        tr.future.set_result(tr.writes)
+
+    def close(self):
+        with self.timer:
+            self.running = False
+            self.due.clear()
+            self.timer.notify()
+        self.thread.join()
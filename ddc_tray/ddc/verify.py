@@ -0,0 +1,124 @@
+import time
+import threading
+from collections import Counter
+from ddc_tray.ddc.interface import DDC_Interface, Monitor, DDCError
+from ddc_tray.ddc.workers import IOPool
+
+class WriteVerifier:
+    '''Write-behind verification of the settled value
+
+    Writes go out with ddca_enable_verify off, so they cost one transaction.
+    Once a (display, feature) pair saw no newer write for settle seconds, the
+    value is read back on the worker of the display. A mismatch re-issues the
+    write and verifies again, at most retries times.
+    '''
+    def __init__(self, ddc: DDC_Interface, pool: IOPool, settle=1.0, retries=2, features=None,
+            monitors=None, cache=None):
+        self.ddc = ddc
+        self.pool = pool
+        self.settle = settle
+        self.retries = retries
+        # features verified on every monitor
+        self.features = {DDC_Interface.VCP.BRIGHTNESS.value, 0x12} if features is None else set(features)
+        # edid key -> features verified on that monitor instead, empty to turn it off
+        self.monitors = dict(monitors or {})
+        self.cache = cache
+        # (display ref, code) -> [mon, code, value, due, attempt]
+        self.pending = {}
+        # bumped on every write, a verification of an older write is dropped
+        self.generation = Counter()
+        self.lock = threading.Condition()
+        self.verified = 0
+        self.rewrites = 0
+        self.gave_up = 0
+        # (edid key, code) -> read backs that did not match
+        self.failures = Counter()
+        self.running = True
+        self.thread = threading.Thread(target=self._loop, name='ddc-verify', daemon=True)
+        self.thread.start()
+
+    def configure(self, mon: Monitor, features):
+        '''features verified on mon, None to go back to the defaults'''
+        with self.lock:
+            if features is None:
+                self.monitors.pop(mon.edid_key, None)
+            else:
+                self.monitors[mon.edid_key] = set(features)
+
+    def enabled(self, mon: Monitor, code: int) -> bool:
+        return code in self.monitors.get(mon.edid_key, self.features)
+
+    def written(self, mon: Monitor, code: int, value: int, attempt=0):
+        '''called after each successful unverified write'''
+        if not self.enabled(mon, code):
+            return
+        key = (mon.display_ref, code)
+        with self.lock:
+            if attempt == 0:
+                self.generation[key] += 1
+            self.pending[key] = [mon, code, value, time.monotonic() + self.settle, attempt]
+            self.lock.notify()
+
+    def _loop(self):
+        with self.lock:
+            while self.running:
+                now = time.monotonic()
+                due = [key for key, p in self.pending.items() if p[3] <= now]
+                for key in due:
+                    mon, code, value, _, attempt = self.pending.pop(key)
+                    self.pool.submit(mon, self._verify, mon, code, value, attempt, self.generation[key])
+                timeout = min((p[3] for p in self.pending.values()), default=now + 60) - now
+                self.lock.wait(max(timeout, 0))
+
+    def _verify(self, mon: Monitor, code: int, value: int, attempt: int, generation: int):
+        key = (mon.display_ref, code)
+        with self.lock:
+            if self.generation[key] != generation or key in self.pending:
+                return
+        try:
+            with self.ddc.open_monitor(mon) as m:
+                current = self.ddc.read_vcp(m, code).value
+                with self.lock:
+                    if self.generation[key] != generation:
+                        return
+                if current == value:
+                    with self.lock:
+                        self.verified += 1
+                    return
+                with self.lock:
+                    self.failures[(mon.edid_key, code)] += 1
+                    if attempt >= self.retries:
+                        self.gave_up += 1
+                        give_up = True
+                    else:
+                        self.rewrites += 1
+                        give_up = False
+                if give_up:
+                    if self.cache:
+                        self.cache.invalidate(mon, code)
+                    return
+                self.ddc.write_vcp(m, code, value)
+        except DDCError:
+            with self.lock:
+                self.failures[(mon.edid_key, code)] += 1
+            if self.cache:
+                self.cache.invalidate(mon, code)
+            return
+        self.written(mon, code, value, attempt + 1)
+
+    def stats(self):
+        with self.lock:
+            return {
+                'verified': self.verified,
+                'failures': sum(self.failures.values()),
+                'rewrites': self.rewrites,
+                'gave_up': self.gave_up,
+                'pending': len(self.pending),
+            }
+
+    def close(self):
+        with self.lock:
+            self.running = False
+            self.pending.clear()
+            self.lock.notify()
+        self.thread.join()
@@ -0,0 +1,84 @@
+import time
+import threading
+from ddc_tray.ddc.interface import Monitor
+
+class WheelAccumulator:
+    '''Relative changes from wheel events, flushed at the pace of each display
+
+    Wheel steps are summed per monitor. flush() turns them into one absolute
+    value per monitor and interval, the interval being the measured write
+    latency of the display (at least min_interval). Steps that arrive while
+    waiting are folded into the next flush, the last one is always flushed.
+    The value steps are added to is the last one flushed, or current(mon) once
+    the monitor was idle for idle seconds, so changes from elsewhere are picked up.
+    '''
+    def __init__(self, write, current, latency=None, step=5, min_interval=0.05, idle=2.0, max_wait=2.0):
+        # called as write(mon, value), should be latest value wins like CoalescingWriter.write
+        self.write = write
+        # VCP_result of mon without blocking, or None while it is being read
+        self.current = current
+        # seconds per write of mon or None, e.g. TransitionEngine.write_latency
+        self.latency = latency or (lambda mon: None)
+        self.step = step
+        self.min_interval = min_interval
+        self.idle = idle
+        # steps are dropped when current() had no value for this long
+        self.max_wait = max_wait
+        # display ref -> [mon, steps, first pending time]
+        self.pending = {}
+        # display ref -> (value, max, time of the flush)
+        self.targets = {}
+        # display ref -> earliest time of the next flush
+        self.next_flush = {}
+        self.lock = threading.Lock()
+        self.flushes = 0
+        self.steps = 0
+
+    def add(self, mon: Monitor, steps: float):
+        with self.lock:
+            self.steps += 1
+            entry = self.pending.get(mon.display_ref)
+            if entry is None:
+                self.pending[mon.display_ref] = [mon, steps, time.monotonic()]
+            else:
+                entry[1] += steps
+
+    def flush(self):
+        '''writes what is due, returns seconds until the next flush is needed or None'''
+        now = time.monotonic()
+        writes = []
+        with self.lock:
+            for key, (mon, steps, since) in list(self.pending.items()):
+                if self.next_flush.get(key, 0) > now:
+                    continue
+                target = self.targets.get(key)
+                if target is None or now - target[2] > self.idle:
+                    res = self.current(mon)
+                    if res is None:
+                        if now - since > self.max_wait:
+                            del self.pending[key]
+                        continue
+                    target = (res.value, res.max, now)
+                delta = round(steps * self.step)
+                if delta == 0:
+                    continue
+                value = min(max(target[0] + delta, 0), target[1])
+                # fractions of a step (touchpads) stay for the next flush
+                remainder = steps - delta / self.step
+                if abs(remainder) > 1e-9 and value not in (0, target[1]):
+                    self.pending[key][1] = remainder
+                else:
+                    del self.pending[key]
+                self.targets[key] = (value, target[1], now)
+                self.next_flush[key] = now + max(self.min_interval, self.latency(mon) or 0)
+                self.flushes += 1
+                if value != target[0]:
+                    writes.append((mon, value))
+            wait = [max(self.next_flush.get(key, 0) - now, self.min_interval) for key in self.pending]
+        for mon, value in writes:
+            self.write(mon, value)
+        return min(wait) if wait else None
+
+    def stats(self):
+        with self.lock:
+            return {'events': self.steps, 'flushes': self.flushes}
@@ -0,0 +1,86 @@
+import time
+import threading
+from dataclasses import dataclass, field
+from concurrent.futures import ThreadPoolExecutor, Future
+from ddc_tray.ddc.interface import DDC_Interface, Monitor
+
+class IOPool:
+    '''One single threaded executor per i2c bus
+
+    All transactions of a display are serialized on its worker, displays on
+    different buses are served in parallel and callers never block on the bus.
+    '''
+    def __init__(self, initializer=None):
+        # called as initializer(mon) on each new worker, for per thread libddcutil settings
+        self.initializer = initializer
+        self.executors = {}
+        self.lock = threading.Lock()
+
+    def executor_for(self, mon: Monitor) -> ThreadPoolExecutor:
+        key = mon.bus if mon.bus >= 0 else mon.display_ref
+        with self.lock:
+            executor = self.executors.get(key)
+            if executor is None:
+                name = f'ddc-bus{mon.bus}' if mon.bus >= 0 else f'ddc-disp{mon.display_idx}'
+                executor = ThreadPoolExecutor(max_workers=1, thread_name_prefix=name,
+                    initializer=self.initializer, initargs=(mon,))
+                self.executors[key] = executor
+            return executor
+
+    def submit(self, mon: Monitor, fn, *args, **kwargs) -> Future:
+        return self.executor_for(mon).submit(fn, *args, **kwargs)
+
+    def shutdown(self, wait=True):
+        with self.lock:
+            executors, self.executors = self.executors, {}
+        for executor in executors.values():
+            executor.shutdown(wait=wait)
+
+@dataclass
+class GroupWrite:
+    start: float
+    # display_idx -> perf_counter() when its write finished
+    done: dict = field(default_factory=dict)
+    errors: dict = field(default_factory=dict)
+
+    @property
+    def skew_ms(self) -> float:
+        '''time between the first and the last display changing, seen as flicker'''
+        return (max(self.done.values()) - min(self.done.values())) * 1000 if self.done else 0.0
+
+    @property
+    def total_ms(self) -> float:
+        return (max(self.done.values()) - self.start) * 1000 if self.done else 0.0
+
+def write_all(ddc: DDC_Interface, pool: IOPool, monitors: list[Monitor], code: int, value: int,
+        cache=None, verifier=None) -> Future:
+    '''one write to every monitor at once, each on the worker of its bus
+
+    The returned future resolves to a GroupWrite when all displays are done.
+    '''
+    result = GroupWrite(start=time.perf_counter())
+    future = Future()
+    remaining = [len(monitors)]
+    lock = threading.Lock()
+
+    def write(mon):
+        try:
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, code, value)
+            if cache:
+                cache.update(mon, code, value)
+            if verifier:
+                verifier.written(mon, code, value)
+        except Exception as e:
+            result.errors[mon.display_idx] = e
+        with lock:
+            result.done[mon.display_idx] = time.perf_counter()
+            remaining[0] -= 1
+            if remaining[0] == 0:
+                future.set_result(result)
+
+    if not monitors:
+        future.set_result(result)
+    for mon in monitors:
+        pool.submit(mon, write, mon)
+    return future
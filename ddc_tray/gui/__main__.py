@@ -1,13 +1,42 @@
+import time
+START = time.perf_counter()
 from PyQt5.QtGui import * 
 from PyQt5.QtWidgets import * 
-import os, signal
+from PyQt5.QtCore import QTimer
+import os, signal, asyncio
 # Fix Ctrl-C, otherwise nothing happens
 signal.signal(signal.SIGINT, signal.SIG_DFL)
 
-from ddc_tray.ddc.ddcutil_cffi import DDC, Monitor
+# libddcutil is only loaded by the backend, on a worker once the icon is up
+from ddc_tray.ddc.interface import DDC_Interface, Monitor
+from ddc_tray.ddc.workers import write_all
+from ddc_tray.ddc.calibrate import SleepCalibration
+from ddc_tray.ddc.cache import MonitorCache, diff_monitors
+from ddc_tray.ddc.registry import monitor_ids
+from ddc_tray.ddc.hotplug import HotplugWatcher
+from ddc_tray.ddc.ambient import IIOLightSensor, TimeOfDayCurve, AutoAdjust
+from ddc_tray.ddc.persist import data_path
+from ddc_tray.ddc.wheel import WheelAccumulator
+from ddc_tray.gui.bridge import ResultBridge, AsyncRunner
+from ddc_tray.gui.backend import Backend
+from ddc_tray.gui.menus import MonitorMenu, VALUE_NAMES
+from ddc_tray.gui.wheel import WheelFilter
 
-ddc = DDC()
-ddc.get_monitors()
+BRIGHTNESS = DDC_Interface.VCP.BRIGHTNESS.value
+monitor_cache = MonitorCache()
+metrics = {}
+calibration = SleepCalibration()
+# set once the worker built it, None until then
+backend = None
+# an open menu waits this long for a value that is not cached, then shows none
+VALUE_TIMEOUT = 0.5
+# brightness change per wheel notch
+WHEEL_STEP = 5
+
+def metric(name: str, label: str):
+    if name not in metrics:
+        metrics[name] = (time.perf_counter() - START) * 1000
+        print(f'time to {label}: {metrics[name]:.1f} ms')
 
 WINDOW_TITLE = 'DDC Tray Settings'
 
@@ -21,10 +50,113 @@ def toggle():
     else:
         window.hide()
 
-def setMon(mon: Monitor, val: int):
-    print('setting', mon, val)
-    with ddc.open_monitor(mon) as m:
-        ddc.write_vcp(m, DDC.VCP.BRIGHTNESS.value, val)
+def writeDone(mon: Monitor, code: int, val: int, error):
+    if error:
+        print('write failed', mon, hex(code), val, error)
+
+def taskDone(tag, result, error):
+    if isinstance(tag, tuple):
+        # ('value', menu) or ('caps', menu) of an opened menu, ('wheel', mon) of a scroll
+        kind, menu = tag
+        if error:
+            if kind == 'wheel':
+                # steps of the monitor are dropped by the accumulator after a while
+                wheel_reads.discard(menu.display_ref)
+            elif kind == 'caps':
+                # asked again the next time the menu opens
+                menu.caps_pending = False
+                print(menu.title(), 'capabilities failed', error)
+        elif kind == 'value':
+            menu.mark(result.value)
+        elif kind == 'wheel':
+            # the value is cached now, the steps waiting for it can go out
+            wheel_reads.discard(menu.display_ref)
+            flushWheel()
+        else:
+            menu.add_features(result)
+        return
+    if error:
+        print(tag, 'failed', error)
+        if tag in ('backend', 'monitors'):
+            detecting_action.setText('No monitors found')
+    elif tag == 'backend':
+        backendReady(result)
+    elif tag == 'monitors':
+        updateMonitors(result)
+    elif tag == 'group':
+        print(f'set all: {result.total_ms:.1f} ms, skew {result.skew_ms:.1f} ms', result.errors or '')
+
+def setMon(mon: Monitor, val: int, code=BRIGHTNESS):
+    print('setting', mon, hex(code), val)
+    # values with names (input source, power mode) are switched, not faded
+    if smooth_toggle.isChecked() and code not in VALUE_NAMES:
+        bridge.watch(backend.transitions.start(mon, code, val), 'transition')
+    else:
+        backend.writer.write(mon, code, val)
+
+def currentValue(menu):
+    mon = monitors.get(menu.key)
+    if backend is None or mon is None or mon.display_ref is None:
+        return None
+    res = backend.vcp_cache.cached(mon, menu.code)
+    if res is None:
+        bridge.watch(runner.submit(backend.read_value(mon, menu.code, VALUE_TIMEOUT)), ('value', menu))
+    return res
+
+def monitorCapabilities(menu):
+    mon = monitors.get(menu.key)
+    if backend is None or mon is None or mon.display_ref is None:
+        return None
+    caps = backend.caps_cache.cached(mon)
+    if caps is None and not menu.caps_pending:
+        menu.caps_pending = True
+        bridge.watch(runner.submit(backend.capabilities(mon)), ('caps', menu))
+    return caps
+
+def wheelCurrent(mon: Monitor):
+    res = backend.vcp_cache.cached(mon, BRIGHTNESS)
+    if res is None and mon.display_ref not in wheel_reads:
+        wheel_reads.add(mon.display_ref)
+        bridge.watch(runner.submit(backend.read_value(mon, BRIGHTNESS, VALUE_TIMEOUT)), ('wheel', mon))
+    return res
+
+def wheelScrolled(obj, steps: float):
+    if backend is None:
+        return
+    # over the icon all monitors, over an open monitor menu only that one
+    if obj is tray:
+        targets = detectedMonitors()
+    else:
+        mon = monitors.get(obj.key)
+        targets = [mon] if mon and mon.display_ref is not None else []
+    for mon in targets:
+        wheel.add(mon, steps)
+    if targets and not wheel_timer.isActive():
+        wheel_timer.start(0)
+
+def flushWheel():
+    # at most one value per monitor and write latency, the last one always goes out
+    wait = wheel.flush()
+    if wait is not None:
+        wheel_timer.start(int(wait * 1000))
+
+def autoAdjustToggled(on: bool):
+    if on:
+        auto_adj_timer.start()
+        auto_adj.tick(detectedMonitors())
+    else:
+        auto_adj_timer.stop()
+        print('auto adjust', auto_adj.stats())
+
+def detectedMonitors() -> list[Monitor]:
+    return [mon for mon in monitors.values() if mon.display_ref is not None]
+
+def setAll(val: int):
+    print('setting all', val)
+    if backend is None:
+        return
+    bridge.watch(write_all(backend.ddc, backend.io_pool, detectedMonitors(), BRIGHTNESS, val,
+        cache=backend.vcp_cache, verifier=backend.verifier), 'group')
 
 def generateMonitorActions(callback, step=10):
     actions = []
@@ -37,6 +169,45 @@ def generateMonitorActions(callback, step=10):
 
 app = QApplication([])
 app.setQuitOnLastWindowClosed(False)
+# bus transactions run on per bus workers, results come back as queued signals
+bridge = ResultBridge()
+bridge.written.connect(writeDone)
+bridge.finished.connect(taskDone)
+runner = AsyncRunner(app)
+
+# ambient light sensor if there is one, a time of day curve otherwise
+light_sensor = IIOLightSensor()
+auto_adj = AutoAdjust(light_sensor if light_sensor.available() else TimeOfDayCurve(),
+    lambda mon, val: backend.transitions.start(mon, BRIGHTNESS, val, duration=2.0))
+auto_adj_timer = QTimer()
+auto_adj_timer.setInterval(int(auto_adj.interval * 1000))
+auto_adj_timer.timeout.connect(lambda: auto_adj.tick(detectedMonitors()))
+
+# scrolling on the icon (or an open monitor menu) changes brightness relatively,
+# the notches are summed and written at the pace the displays can take
+wheel = WheelAccumulator(lambda mon, val: backend.writer.write(mon, BRIGHTNESS, val), wheelCurrent,
+    latency=lambda mon: backend.transitions.write_latency(mon), step=WHEEL_STEP)
+wheel_reads = set()
+wheel_timer = QTimer()
+wheel_timer.setSingleShot(True)
+wheel_timer.timeout.connect(flushWheel)
+wheel_filter = WheelFilter()
+wheel_filter.scrolled.connect(wheelScrolled)
+
+# DDC call telemetry, a textfile for the node_exporter collector and a local endpoint.
+# with a daemon the calls happen there, it writes the textfile and serves the endpoint
+telemetry_file = os.environ.get('DDC_TRAY_TEXTFILE') or data_path('ddc_tray.prom')
+telemetry_timer = QTimer()
+telemetry_timer.setInterval(15000)
+metrics_port = int(os.environ.get('DDC_TRAY_METRICS_PORT', 9464))
+def startTelemetry(telemetry):
+    telemetry_timer.timeout.connect(lambda: telemetry.write_textfile(telemetry_file))
+    telemetry_timer.start()
+    if metrics_port:
+        try:
+            telemetry.serve(metrics_port)
+        except OSError as e:
+            print('metrics endpoint not started:', e)
 # Adding an icon
 base_path = os.path.dirname(__file__)
 icon = QIcon(f"{base_path}/icons/custom_tray.png")
@@ -58,6 +229,9 @@ tray = QSystemTrayIcon(icon=icon)
 tray.setIcon(icon)
 tray.setVisible(True)
 tray.activated.connect(toggle)
+wheel_filter.watch(tray)
+# the icon is on screen once the event loop runs
+QTimer.singleShot(0, lambda: metric('icon_visible_ms', 'icon visible'))
 
 # Creating the options
 context_menu = QMenu()
@@ -66,6 +240,11 @@ main_action.triggered.connect(toggle)
 
 auto_adj_toggle = QAction("Auto Adjust")
 auto_adj_toggle.setCheckable(True)
+auto_adj_toggle.toggled.connect(autoAdjustToggled)
+
+smooth_toggle = QAction("Smooth Transitions")
+smooth_toggle.setCheckable(True)
+smooth_toggle.setChecked(True)
 
 
 # To quit the app
@@ -74,29 +253,87 @@ quit_action.triggered.connect(app.quit)
 
 context_menu.addAction(main_action)
 context_menu.addAction(auto_adj_toggle)
+context_menu.addAction(smooth_toggle)
 context_menu.addSeparator()
+all_menu = QMenu('All monitors')
+all_actions = generateMonitorActions(setAll)
+all_menu.addActions(all_actions)
+context_menu.addMenu(all_menu)
+# shown until the first monitor is known
+detecting_action = QAction('Detecting monitors…')
+detecting_action.setEnabled(False)
+context_menu.addAction(detecting_action)
+monitors_end = context_menu.addSeparator()
+context_menu.addAction(quit_action)
 
-actions = [None]*10
-def genMenu(mon: Monitor) -> QMenu:
-    menu = QMenu(str(mon))
-    actions[mon.display_idx] = generateMonitorActions(lambda val, mon=mon: setMon(mon, val))
-    menu.addActions(actions[mon.display_idx])
-    print(menu)
+# keyed by monitor id (EDID, plus the bus for identical monitors),
+# actions look up the current Monitor on click
+monitors = {}
+men = {}
+def genMenu(uid: str, mon: Monitor) -> QMenu:
+    # empty until first opened, the cost per monitor is one QMenu
+    menu = MonitorMenu(str(mon), uid, lambda key, code, val: setMon(monitors[key], val, code),
+        currentValue, monitorCapabilities)
+    # cached entries stay disabled until the bus probe found them
+    menu.setEnabled(mon.display_ref is not None)
+    wheel_filter.watch(menu)
     return menu
 
-men = [None]*10
-for mon in ddc.monitors:
-    men[mon.display_idx] = genMenu(mon)
-    context_menu.addMenu(men[mon.display_idx])
+def addMonitor(uid: str, mon: Monitor):
+    detecting_action.setVisible(False)
+    monitors[uid] = mon
+    men[uid] = genMenu(uid, mon)
+    context_menu.insertMenu(monitors_end, men[uid])
+
+def removeMonitor(uid: str):
+    del monitors[uid]
+    context_menu.removeAction(men.pop(uid).menuAction())
+    if not monitors:
+        detecting_action.setText('No monitors found')
+        detecting_action.setVisible(True)
+
+def updateMonitors(fresh: list[Monitor]):
+    by_id = monitor_ids(fresh)
+    added, changed, removed = diff_monitors(monitors, by_id)
+    for uid in list(removed) + list(changed):
+        removeMonitor(uid)
+    for uid, mon in (changed | added).items():
+        addMonitor(uid, mon)
+    for uid, mon in by_id.items():
+        monitors[uid] = mon
+        # plugged after libddcutil started, listed but not usable until a restart
+        men[uid].setEnabled(mon.display_ref is not None)
+    monitor_cache.save(fresh)
+    if not fresh:
+        detecting_action.setText('No monitors found')
+    metric('menu_verified_ms', 'verified menu')
+
+def backendReady(result: Backend):
+    global backend
+    backend = result
+    metric('backend_ms', 'backend ready')
+    app.aboutToQuit.connect(backend.close)
+    if backend.ddc.telemetry:
+        startTelemetry(backend.ddc.telemetry)
+    # bus probe runs in the background, the menu starts from the cached enumeration
+    bridge.watch(runner.submit(backend.aio.get_monitors_async()), 'monitors')
+    # plug events only re-probe the affected buses
+    hotplug = HotplugWatcher(lambda added, removed:
+        bridge.watch(runner.submit(backend.aio.update_buses_async(added, removed)), 'monitors'))
+    hotplug.start()
+    app.aboutToQuit.connect(hotplug.stop)
+
+for uid, mon in monitor_ids(monitor_cache.load()).items():
+    addMonitor(uid, mon)
 
-context_menu.addSeparator()
-context_menu.addAction(quit_action)
-  
 # Adding options to the System Tray
 tray.setContextMenu(context_menu)
+metric('first_menu_ms', 'first menu')
+# libddcutil init (or the daemon connection) off the Qt thread
+bridge.watch(runner.submit(asyncio.to_thread(Backend, bridge.on_written, calibration)), 'backend')
 
 def rem_acc():
     context_menu.removeAction(option1)
 btn_bottom.clicked.connect(rem_acc)
   
-app.exec_()
+runner.exec_()
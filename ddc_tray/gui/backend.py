@@ -0,0 +1,57 @@
+import asyncio
+from ddc_tray.ddc.interface import Monitor, VCP_result, Capabilities
+from ddc_tray.ddc.scheduler import CoalescingWriter
+from ddc_tray.ddc.workers import IOPool
+from ddc_tray.ddc.calibrate import SleepCalibration
+from ddc_tray.ddc.cache import VCPCache, CapabilitiesCache
+from ddc_tray.ddc.transition import TransitionEngine
+from ddc_tray.ddc.aio import AsyncDDC
+from ddc_tray.ddc.verify import WriteVerifier
+from ddc_tray.ddc.client import DaemonClient, RemoteDDC
+
+class Backend:
+    '''The DDC side of the tray
+
+    Loading libddcutil (or connecting to the daemon) can take a while at login,
+    so the tray builds this on a worker after its icon is up.
+    '''
+    def __init__(self, on_written, calibration: SleepCalibration):
+        # a running daemon owns the buses, the tray is one of its clients
+        self.daemon = DaemonClient.connect()
+        if self.daemon:
+            self.ddc = RemoteDDC(self.daemon)
+        else:
+            from ddc_tray.ddc.ddcutil_cffi import DDC
+            self.ddc = DDC(telemetry=True, adaptive_retries=True)
+        self.calibration = calibration
+        self.vcp_cache = VCPCache(self.ddc)
+        self.caps_cache = CapabilitiesCache()
+        self.io_pool = IOPool(initializer=None if self.daemon else calibration.initializer(self.ddc))
+        # the daemon verifies the writes of all its clients
+        self.verifier = None if self.daemon else WriteVerifier(self.ddc, self.io_pool, cache=self.vcp_cache)
+        self.transitions = TransitionEngine(self.ddc, self.io_pool, cache=self.vcp_cache, verifier=self.verifier)
+        self.aio = AsyncDDC(self.ddc, self.io_pool)
+        # on_written is called from the workers after each bus write
+        self.writer = CoalescingWriter(self.ddc, executor_for=self.io_pool.executor_for, on_result=on_written,
+            cache=self.vcp_cache, verifier=self.verifier)
+
+    async def read_value(self, mon: Monitor, code: int, timeout: float) -> VCP_result:
+        '''through the VCP cache, a read still queued at the timeout is dropped'''
+        return await asyncio.wait_for(self.aio.run_async(mon, self.vcp_cache.read, mon, code), timeout)
+
+    def _capabilities(self, mon: Monitor):
+        with self.ddc.open_monitor(mon) as m:
+            return self.caps_cache.get(self.ddc, m, mon)
+
+    async def capabilities(self, mon: Monitor) -> Capabilities:
+        return await self.aio.run_async(mon, self._capabilities, mon)
+
+    def close(self):
+        self.transitions.close()
+        self.aio.shutdown()
+        if self.verifier:
+            self.verifier.close()
+        self.io_pool.shutdown()
+        if self.ddc.telemetry:
+            self.ddc.telemetry.close()
+        self.ddc.close()
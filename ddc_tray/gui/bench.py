@@ -0,0 +1,104 @@
+import os
+import sys
+import time
+import argparse
+import tempfile
+import subprocess
+os.environ.setdefault('QT_QPA_PLATFORM', 'offscreen')
+from PyQt5.QtCore import QCoreApplication, QTimer
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, ffi as sim_ffi
+from ddc_tray.ddc.scheduler import CoalescingWriter
+from ddc_tray.ddc.workers import IOPool
+from ddc_tray.gui.bridge import ResultBridge
+
+TICK_MS = 5
+
+def measure_stall(app, write, n, interval_ms, pending=lambda: False):
+    '''max and total delay of a fast timer while n writes are issued from the event loop'''
+    gaps = []
+    last = [time.perf_counter()]
+    def on_tick():
+        now = time.perf_counter()
+        gaps.append(now - last[0])
+        last[0] = now
+    tick = QTimer()
+    tick.timeout.connect(on_tick)
+    tick.start(TICK_MS)
+
+    issued = [0]
+    def on_write():
+        if issued[0] < n:
+            write(issued[0])
+            issued[0] += 1
+        elif not pending():
+            app.quit()
+    writes = QTimer()
+    writes.timeout.connect(on_write)
+    writes.start(interval_ms)
+    app.exec_()
+    tick.stop()
+    writes.stop()
+    stalls = [max(0, g*1000 - TICK_MS) for g in gaps]
+    return {'max_stall_ms': max(stalls), 'total_stall_ms': sum(stalls)}
+
+def bench_stall(args):
+    '''GUI event loop stall with and without the DDC worker layer'''
+    app = QCoreApplication(sys.argv)
+
+    ddc = DDC(sim_ffi, SimLib(monitors=args.monitors, time_scale=args.time_scale))
+    mons = ddc.get_monitors()
+    def blocking_write(i):
+        for mon in mons:
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, DDC.VCP.BRIGHTNESS.value, i % 101)
+    print('workers off:', measure_stall(app, blocking_write, args.n, args.interval))
+
+    pool = IOPool()
+    bridge = ResultBridge()
+    writer = CoalescingWriter(ddc, executor_for=pool.executor_for, on_result=bridge.on_written)
+    def queued_write(i):
+        for mon in mons:
+            writer.write(mon, DDC.VCP.BRIGHTNESS.value, i % 101)
+    print('workers on: ', measure_stall(app, queued_write, args.n, args.interval,
+        pending=lambda: bool(writer.in_flight)), writer.stats())
+    pool.shutdown()
+    ddc.close()
+
+def bench_startup(args):
+    '''process start to icon visible, first menu and verified menu of the tray, first run without monitor cache'''
+    env = dict(os.environ, XDG_CACHE_HOME=tempfile.mkdtemp(), DDC_TRAY_METRICS_PORT='0', PYTHONUNBUFFERED='1')
+    if not args.real:
+        env['DDC_TRAY_SIM'] = f'{args.monitors},{args.time_scale}'
+    for run in range(args.n):
+        start = time.perf_counter()
+        proc = subprocess.Popen([sys.executable, '-m', 'ddc_tray.gui'], env=env, text=True,
+            stdout=subprocess.PIPE, stderr=subprocess.DEVNULL)
+        seen = {}
+        for line in proc.stdout:
+            if line.startswith('time to '):
+                seen[line[8:].split(':')[0]] = (time.perf_counter() - start) * 1000
+                if 'verified menu' in seen:
+                    break
+        proc.terminate()
+        proc.wait()
+        print(f'{"cold" if run == 0 else "warm"}: ' + ', '.join(f'{label} {ms:.0f} ms' for label, ms in seen.items()))
+
+BENCHMARKS = {
+    'stall': bench_stall,
+    'startup': bench_startup,
+}
+
+def main():
+    parser = argparse.ArgumentParser(description='GUI benchmarks')
+    parser.add_argument('bench', choices=BENCHMARKS, nargs='?', default='stall')
+    parser.add_argument('-n', type=int, default=20)
+    parser.add_argument('--monitors', type=int, default=2)
+    parser.add_argument('--interval', type=int, default=30, help='ms between clicks')
+    parser.add_argument('--time-scale', type=float, default=1.0)
+    parser.add_argument('--real', action='store_true', help='startup: use libddcutil and real monitors')
+    args = parser.parse_args()
+    BENCHMARKS[args.bench](args)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,55 @@
+import asyncio
+import threading
+from concurrent.futures import Future
+from PyQt5.QtCore import QObject, pyqtSignal
+
+class ResultBridge(QObject):
+    '''Hands results from the DDC worker threads to the Qt thread
+
+    Signals emitted from a worker are queued, connected slots run in the event loop.
+    '''
+    written = pyqtSignal(object, int, int, object) # monitor, code, value, error
+    finished = pyqtSignal(object, object, object) # tag, result, error
+
+    def on_written(self, mon, code, value, error):
+        self.written.emit(mon, code, value, error)
+
+    def watch(self, future: Future, tag=None) -> Future:
+        def done(f):
+            if not f.cancelled():
+                error = f.exception()
+                self.finished.emit(tag, None if error else f.result(), error)
+        future.add_done_callback(done)
+        return future
+
+class AsyncRunner:
+    '''Runs coroutines for the tray
+
+    With qasync installed they run on the Qt event loop itself, otherwise on an
+    asyncio loop in a helper thread. Either way submit() returns a concurrent
+    future that ResultBridge.watch() can hand back to Qt.
+    '''
+    def __init__(self, app):
+        self.app = app
+        try:
+            import qasync
+            self.loop = qasync.QEventLoop(app)
+            asyncio.set_event_loop(self.loop)
+            self.thread = None
+        except ImportError:
+            self.loop = asyncio.new_event_loop()
+            self.thread = threading.Thread(target=self.loop.run_forever, name='ddc-asyncio', daemon=True)
+            self.thread.start()
+
+    def submit(self, coro) -> Future:
+        return asyncio.run_coroutine_threadsafe(coro, self.loop)
+
+    def exec_(self):
+        if self.thread:
+            ret = self.app.exec_()
+            self.loop.call_soon_threadsafe(self.loop.stop)
+            return ret
+        quit_event = asyncio.Event()
+        self.app.aboutToQuit.connect(quit_event.set)
+        with self.loop:
+            self.loop.run_until_complete(quit_event.wait())
@@ -0,0 +1,99 @@
+from PyQt5.QtWidgets import QMenu, QAction, QActionGroup
+from ddc_tray.ddc.interface import DDC_Interface, Capabilities
+
+BRIGHTNESS = DDC_Interface.VCP.BRIGHTNESS.value
+# features offered in the monitor menu when the capabilities list them, in menu order
+FEATURES = {
+    0x12: 'Contrast',
+    0x62: 'Volume',
+    0x16: 'Red gain',
+    0x18: 'Green gain',
+    0x1a: 'Blue gain',
+    0x60: 'Input source',
+    0xd6: 'Power mode',
+}
+# names of non continuous values, MCCS 2.2
+VALUE_NAMES = {
+    0x60: {0x01: 'VGA 1', 0x02: 'VGA 2', 0x03: 'DVI 1', 0x04: 'DVI 2', 0x0f: 'DisplayPort 1',
+        0x10: 'DisplayPort 2', 0x11: 'HDMI 1', 0x12: 'HDMI 2', 0x1b: 'USB-C'},
+    0xd6: {0x01: 'On', 0x02: 'Standby', 0x03: 'Suspend', 0x04: 'Off', 0x05: 'Off (button)'},
+}
+
+class FeatureMenu(QMenu):
+    '''Values of one VCP feature, nothing is built until the menu is first opened
+
+    Each time it opens the current value is checked. current(menu) returns the
+    cached VCP_result or None, in which case it arranges for mark() to be called
+    once a read finished, the menu never waits for the bus.
+    '''
+    def __init__(self, title: str, key: str, code: int, on_select, current, values=None, step=10):
+        super().__init__(title)
+        self.key = key
+        self.code = code
+        # called as on_select(key, code, value)
+        self.on_select = on_select
+        self.current = current
+        # declared values of a non continuous feature, None for a 0-100 range
+        self.values = values
+        self.step = step
+        self.group = None
+        self.aboutToShow.connect(self._show)
+
+    def _labels(self):
+        if self.values is None:
+            return [(v, f'{v} %') for v in range(0, 100 + 1, self.step)]
+        names = VALUE_NAMES.get(self.code, {})
+        return [(v, names.get(v, f'0x{v:02x}')) for v in self.values]
+
+    def _build(self):
+        self.group = QActionGroup(self)
+        for value, label in self._labels():
+            act = QAction(label, self.group)
+            act.setCheckable(True)
+            act.setData(value)
+            act.triggered.connect(lambda _, value=value: self.on_select(self.key, self.code, value))
+            self.addAction(act)
+
+    def _show(self):
+        if self.group is None:
+            self._build()
+        res = self.current(self)
+        self.mark(res.value if res else None)
+
+    def mark(self, value):
+        if self.group is None:
+            return
+        if value is not None and self.values is None:
+            value = min(round(value / self.step) * self.step, 100)
+        for act in self.group.actions():
+            act.setChecked(act.data() == value)
+
+class MonitorMenu(FeatureMenu):
+    '''Brightness of a monitor, with submenus for the other features it supports
+
+    capabilities(menu) returns the Capabilities or None, and then arranges for
+    add_features() once they were read.
+    '''
+    def __init__(self, title: str, key: str, on_select, current, capabilities):
+        super().__init__(title, key, BRIGHTNESS, on_select, current)
+        self.capabilities = capabilities
+        # set by the caller while a capabilities read is under way
+        self.caps_pending = False
+        self.features = None
+
+    def _show(self):
+        super()._show()
+        if self.features is None:
+            caps = self.capabilities(self)
+            if caps:
+                self.add_features(caps)
+
+    def add_features(self, caps: Capabilities):
+        if self.features is not None:
+            return
+        self.features = [FeatureMenu(name, self.key, code, self.on_select, self.current,
+            values=caps.features[code] or None) for code, name in FEATURES.items() if caps.supports(code)]
+        if self.features:
+            self.addSeparator()
+        for menu in self.features:
+            self.addMenu(menu)
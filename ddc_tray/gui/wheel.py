@@ -0,0 +1,23 @@
+from PyQt5.QtCore import QObject, QEvent, pyqtSignal
+
+class WheelFilter(QObject):
+    '''Turns wheel events on the watched objects into steps, 1.0 per notch up
+
+    QSystemTrayIcon has no wheel signal, on X11 the icon forwards the events of
+    its embedded window to itself, so an event filter on it sees them. The
+    watched object is passed along to tell the targets apart.
+    '''
+    scrolled = pyqtSignal(object, float) # watched object, steps
+
+    def watch(self, obj: QObject):
+        obj.installEventFilter(self)
+
+    def eventFilter(self, obj, event):
+        if event.type() != QEvent.Wheel:
+            return False
+        delta = event.angleDelta()
+        # horizontal scrolling counts too, touchpads send fractions of a notch
+        steps = (delta.y() or delta.x()) / 120
+        if steps:
+            self.scrolled.emit(obj, steps)
+        return True
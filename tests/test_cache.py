@@ -0,0 +1,87 @@
+import time
+import unittest
+from ddc_tray.ddc.interface import Monitor, VCP_result
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, SimDisplay, ffi as sim_ffi
+from ddc_tray.ddc.cache import VCPCache
+from ddc_tray.ddc.registry import MonitorRegistry, monitor_ids
+
+BRIGHTNESS = DDC.VCP.BRIGHTNESS.value
+INPUT_SOURCE = DDC.VCP.INPUT_SOURCE.value
+
+class VCPCacheTest(unittest.TestCase):
+    def setUp(self):
+        self.lib = SimLib(monitors=1, time_scale=0)
+        self.ddc = DDC(sim_ffi, self.lib)
+        self.mon = self.ddc.get_monitors()[0]
+        self.display = self.lib.displays[0]
+
+    def tearDown(self):
+        self.ddc.close()
+
+    def bus_reads(self):
+        return self.lib.calls['ddca_get_non_table_vcp_value']
+
+    def test_ttl(self):
+        cache = VCPCache(self.ddc, default_ttl=0.05)
+        self.assertIsNone(cache.cached(self.mon, BRIGHTNESS))
+        first = cache.read(self.mon, BRIGHTNESS)
+        self.assertEqual(cache.read(self.mon, BRIGHTNESS), first)
+        self.assertEqual(self.bus_reads(), 1)
+        time.sleep(0.06)
+        self.assertIsNone(cache.cached(self.mon, BRIGHTNESS))
+        cache.read(self.mon, BRIGHTNESS)
+        self.assertEqual(self.bus_reads(), 2)
+
+    def test_volatile(self):
+        # the monitor switches inputs on its own, every read goes to the bus
+        cache = VCPCache(self.ddc)
+        cache.read(self.mon, INPUT_SOURCE)
+        self.display.values[INPUT_SOURCE][0] = 0x11
+        self.assertIsNone(cache.cached(self.mon, INPUT_SOURCE))
+        self.assertEqual(cache.read(self.mon, INPUT_SOURCE).value, 0x11)
+        self.assertEqual(self.bus_reads(), 2)
+
+    def test_written_values(self):
+        cache = VCPCache(self.ddc)
+        # nothing to keep the max from yet
+        cache.update(self.mon, BRIGHTNESS, 40)
+        self.assertIsNone(cache.cached(self.mon, BRIGHTNESS))
+        res = cache.read(self.mon, BRIGHTNESS)
+        cache.update(self.mon, BRIGHTNESS, 40)
+        self.assertEqual(cache.cached(self.mon, BRIGHTNESS), VCP_result(value=40, max=res.max))
+        cache.invalidate(self.mon)
+        self.assertIsNone(cache.cached(self.mon, BRIGHTNESS))
+        self.assertEqual(self.bus_reads(), 1)
+
+class MonitorIdsTest(unittest.TestCase):
+    def monitor(self, idx, bus, edid):
+        return Monitor(display_idx=idx, display_ref=None, model='', manufacturer='', vcp_ver='', bus=bus,
+            edid=edid)
+
+    def test_identical_edids(self):
+        # two of the same model with no serial in the EDID
+        edid = SimDisplay(dispno=1, busno=3, model='Twin', sn='').edid()
+        first, second = self.monitor(1, 3, edid), self.monitor(2, 5, edid)
+        key = first.edid_key
+        self.assertEqual(monitor_ids([second, first]), {key: first, f'{key}@5': second})
+
+    def test_distinct_edids(self):
+        mons = [self.monitor(i, i + 2, SimDisplay(dispno=i, busno=i + 2, model=f'M{i}').edid())
+            for i in (1, 2)]
+        self.assertEqual(monitor_ids(mons), {mon.edid_key: mon for mon in mons})
+
+    def test_registry_keeps_twins_apart(self):
+        edid = SimDisplay(dispno=1, busno=3, model='Twin', sn='').edid()
+        registry = MonitorRegistry()
+        first, second = self.monitor(1, 3, edid), self.monitor(2, 5, edid)
+        registry.replace([first, second])
+        self.assertNotEqual(registry.id_of(first), registry.id_of(second))
+        # a rescan maps each one back to the object callers hold
+        added, removed = registry.replace([self.monitor(2, 5, edid), self.monitor(1, 3, edid)])
+        self.assertEqual((added, removed), ([], []))
+        self.assertEqual(registry.monitors, [first, second])
+        self.assertIs(registry.bus(5), second)
+
+if __name__ == '__main__':
+    unittest.main()
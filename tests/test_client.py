@@ -0,0 +1,94 @@
+import os
+import socket
+import asyncio
+import tempfile
+import threading
+import unittest
+from ddc_tray.ddc.interface import DDCError
+from ddc_tray.ddc.client import DaemonClient, RemoteDDC
+from ddc_tray.ddc.daemon import Daemon
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, ffi as sim_ffi
+
+class SilentServer:
+    '''accepts connections on a unix socket and never answers'''
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.bind(path)
+        self.sock.listen()
+        self.conns = []
+        threading.Thread(target=self._accept, daemon=True).start()
+
+    def _accept(self):
+        while True:
+            try:
+                self.conns.append(self.sock.accept()[0])
+            except OSError:
+                return
+
+    def drop(self):
+        '''the daemon goes away'''
+        self.sock.close()
+        for conn in self.conns:
+            conn.shutdown(socket.SHUT_RDWR)
+            conn.close()
+
+class DaemonClientTest(unittest.TestCase):
+    def setUp(self):
+        self.path = os.path.join(tempfile.mkdtemp(), 'ddc.sock')
+
+    def tearDown(self):
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        os.rmdir(os.path.dirname(self.path))
+
+    def start_daemon(self):
+        loop = asyncio.new_event_loop()
+        threading.Thread(target=loop.run_forever, daemon=True).start()
+        daemon = Daemon(DDC(sim_ffi, SimLib(monitors=1, time_scale=0)), self.path, hotplug=False)
+        asyncio.run_coroutine_threadsafe(daemon.start(), loop).result()
+        def stop():
+            asyncio.run_coroutine_threadsafe(asyncio.sleep(0), loop).result()
+            loop.call_soon_threadsafe(daemon.close)
+            loop.call_soon_threadsafe(loop.stop)
+        self.addCleanup(stop)
+
+    def test_timeout(self):
+        server = SilentServer(self.path)
+        client = DaemonClient(self.path, timeout=0.05)
+        with self.assertRaises(DDCError):
+            client.call('ls')
+        self.assertEqual(client.pending, {})
+        client.close()
+        server.drop()
+
+    def test_connection_lost(self):
+        server = SilentServer(self.path)
+        client = DaemonClient(self.path, timeout=5)
+        future = client.call_async('ls')
+        server.drop()
+        with self.assertRaises(DDCError):
+            future.result(5)
+        client.reader.join(5)
+        self.assertFalse(client.alive)
+        with self.assertRaises(DDCError):
+            client.call('ls')
+        self.assertEqual(client.pending, {})
+
+    def test_reconnect(self):
+        server = SilentServer(self.path)
+        remote = RemoteDDC(DaemonClient(self.path, timeout=5))
+        server.drop()
+        remote.client.reader.join(5)
+        os.unlink(self.path)
+        # nobody listening
+        with self.assertRaises(DDCError):
+            remote.get_monitors()
+        self.start_daemon()
+        mon = remote.get_monitors()[0]
+        with remote.open_monitor(mon) as m:
+            self.assertEqual(remote.read_vcp(m, DDC.VCP.BRIGHTNESS.value).max, 100)
+        remote.close()
+
+if __name__ == '__main__':
+    unittest.main()
@@ -0,0 +1,148 @@
+import os
+import shutil
+import tempfile
+import unittest
+from ddc_tray.ddc.interface import parse_edid, DDCError
+from ddc_tray.ddc.hotplug import HotplugWatcher
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, SimDisplay, ffi as sim_ffi
+
+class FakeTree:
+    '''sysfs DRM connectors and /dev/i2c-* nodes under a temporary root'''
+    def __init__(self):
+        self.root = tempfile.mkdtemp()
+        self.sysfs = os.path.join(self.root, 'sys')
+        self.dev = os.path.join(self.root, 'dev')
+        os.makedirs(os.path.join(self.sysfs, 'class', 'drm'))
+        os.makedirs(os.path.join(self.sysfs, 'bus', 'i2c', 'devices'))
+        os.makedirs(self.dev)
+
+    def connector(self, name, bus, edid=b'', status='connected', aux=False, node=True):
+        path = os.path.join(self.sysfs, 'class', 'drm', name)
+        os.makedirs(path, exist_ok=True)
+        if aux:
+            # DP connectors carry their aux channel adapter as a child
+            os.makedirs(os.path.join(path, f'i2c-{bus}'), exist_ok=True)
+        else:
+            adapter = os.path.join(self.sysfs, 'bus', 'i2c', 'devices', f'i2c-{bus}')
+            os.makedirs(adapter, exist_ok=True)
+            if not os.path.lexists(os.path.join(path, 'ddc')):
+                os.symlink(adapter, os.path.join(path, 'ddc'))
+        self.set(name, edid=edid, status=status)
+        if node:
+            open(os.path.join(self.dev, f'i2c-{bus}'), 'w').close()
+
+    def set(self, name, edid=None, status=None):
+        path = os.path.join(self.sysfs, 'class', 'drm', name)
+        if status is not None:
+            with open(os.path.join(path, 'status'), 'w') as f:
+                f.write(status + '\n')
+        if edid is not None:
+            with open(os.path.join(path, 'edid'), 'wb') as f:
+                f.write(edid)
+
+    def close(self):
+        shutil.rmtree(self.root)
+
+class ParseEdidTest(unittest.TestCase):
+    def test_names(self):
+        edid = SimDisplay(dispno=1, busno=3, mfg_id='DEL', model='U2720Q', sn='ABC123').edid()
+        self.assertEqual(parse_edid(edid), ('DEL', 'U2720Q', 'ABC123'))
+
+    def test_short(self):
+        self.assertEqual(parse_edid(b'\x00' * 16), ('', '', ''))
+
+class HotplugWatcherTest(unittest.TestCase):
+    def setUp(self):
+        self.tree = FakeTree()
+        self.edid = SimDisplay(dispno=1, busno=3, model='A').edid()
+        self.tree.connector('card0-HDMI-A-1', 3, self.edid)
+
+    def tearDown(self):
+        self.tree.close()
+
+    def watcher(self):
+        return HotplugWatcher(lambda added, removed: None, sysfs_root=self.tree.sysfs, dev_root=self.tree.dev)
+
+    def test_scan(self):
+        aux_edid = SimDisplay(dispno=2, busno=7, model='B').edid()
+        self.tree.connector('card0-DP-1', 7, aux_edid, aux=True)
+        self.tree.connector('card0-DP-2', 8, status='disconnected')
+        # connected, but no i2c-dev node to talk to it
+        self.tree.connector('card0-eDP-1', 9, node=False)
+        self.assertEqual(self.watcher().scan(), {3: self.edid, 7: aux_edid})
+
+    def test_poll(self):
+        watcher = self.watcher()
+        self.assertEqual(watcher.poll(), ({}, []))
+
+        edid = SimDisplay(dispno=2, busno=4, model='B').edid()
+        self.tree.connector('card0-DP-1', 4, edid)
+        self.assertEqual(watcher.poll(), ({4: edid}, []))
+
+        # a different monitor on the same connector
+        other = SimDisplay(dispno=2, busno=4, model='C').edid()
+        self.tree.set('card0-DP-1', edid=other)
+        self.assertEqual(watcher.poll(), ({4: other}, []))
+
+        self.tree.set('card0-HDMI-A-1', status='disconnected')
+        self.assertEqual(watcher.poll(), ({}, [3]))
+        self.assertEqual(watcher.poll(), ({}, []))
+
+class UpdateBusesTest(unittest.TestCase):
+    def setUp(self):
+        self.lib = SimLib(monitors=2, time_scale=0)
+        self.ddc = DDC(sim_ffi, self.lib)
+        self.ddc.get_monitors()
+
+    def tearDown(self):
+        self.ddc.close()
+
+    def buses(self):
+        return sorted(mon.bus for mon in self.ddc.monitors)
+
+    def test_unplug_and_replug(self):
+        first = self.ddc.registry.bus(3)
+        edid = first.edid
+        self.lib.unplug(first.display_idx)
+        self.ddc.update_buses({}, [3])
+        self.assertEqual(self.buses(), [4])
+
+        # a display ref detection created is found again by bus
+        self.lib.plug(self.lib.detected[0])
+        self.ddc.update_buses({3: edid}, [])
+        self.assertEqual(self.buses(), [3, 4])
+        mon = self.ddc.registry.bus(3)
+        self.assertEqual(mon.display_ref, first.display_ref)
+        self.assertEqual((mon.model, mon.vcp_ver), ('Virtual 1', '2.1'))
+        with self.ddc.open_monitor(mon) as m:
+            self.assertEqual(self.ddc.read_vcp(m, DDC.VCP.BRIGHTNESS.value).max, 100)
+
+    def test_unplug_forgets_retry_stats(self):
+        ddc = DDC(sim_ffi, SimLib(monitors=2, time_scale=0), adaptive_retries=True)
+        first, second = ddc.get_monitors()
+        for mon in (first, second):
+            with ddc.open_monitor(mon) as m:
+                ddc.write_vcp(m, DDC.VCP.BRIGHTNESS.value, 30)
+        ddc.update_buses({}, [first.bus])
+        self.assertEqual({key for key, _ in ddc.retry.stats_by}, {second.edid_key})
+        ddc.close()
+
+    def test_new_display_undetected(self):
+        # detection at startup never saw this one, libddcutil has no display ref for
+        # it until a restart. It is listed from its EDID and cannot be opened
+        display = SimDisplay(dispno=3, busno=9, model='Virtual 3', sn='SIM0003', product_code=0x1002)
+        self.lib.plug(display)
+        self.ddc.update_buses({9: display.edid()}, [])
+        self.assertEqual(self.buses(), [3, 4, 9])
+        mon = self.ddc.registry.bus(9)
+        self.assertIsNone(mon.display_ref)
+        self.assertEqual((mon.model, mon.sn), ('Virtual 3', 'SIM0003'))
+        with self.assertRaises(DDCError):
+            with self.ddc.open_monitor(mon):
+                pass
+        # a full enumeration does not redetect either
+        self.assertEqual(sorted(m.bus for m in self.ddc.get_monitors()), [3, 4])
+
+if __name__ == '__main__':
+    unittest.main()
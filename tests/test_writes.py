@@ -0,0 +1,142 @@
+import time
+import unittest
+from ddc_tray.ddc.interface import Monitor, VCP_result
+from ddc_tray.ddc.ddcutil_cffi import DDC
+from ddc_tray.ddc.ddcutil_sim import SimLib, ffi as sim_ffi
+from ddc_tray.ddc.scheduler import CoalescingWriter
+from ddc_tray.ddc.transition import TransitionEngine
+from ddc_tray.ddc.wheel import WheelAccumulator
+from ddc_tray.ddc.workers import IOPool
+
+BRIGHTNESS = DDC.VCP.BRIGHTNESS.value
+
+class SimTestCase(unittest.TestCase):
+    '''one simulated display without bus delays, writes counted by the sim'''
+    def setUp(self):
+        self.lib = SimLib(monitors=1, time_scale=0)
+        self.ddc = DDC(sim_ffi, self.lib)
+        self.mon = self.ddc.get_monitors()[0]
+        self.display = self.lib.displays[0]
+
+    def tearDown(self):
+        self.ddc.close()
+
+    def bus_writes(self):
+        return self.lib.calls['ddca_set_non_table_vcp_value']
+
+class CoalescingWriterTest(SimTestCase):
+    def test_burst(self):
+        writer = CoalescingWriter(self.ddc)
+        # the first write waits for the bus, the rest of the burst queues behind it
+        with self.lib.bus_locks[self.mon.bus]:
+            for value in range(20, 40):
+                writer.write(self.mon, BRIGHTNESS, value)
+        self.assertTrue(writer.join(5))
+        writer.close()
+        self.assertEqual(self.bus_writes(), 2)
+        self.assertEqual(self.display.values[BRIGHTNESS][0], 39)
+        self.assertEqual(writer.stats(), {'issued': 2, 'coalesced': 18})
+
+    def test_separate_codes(self):
+        writer = CoalescingWriter(self.ddc)
+        writer.write(self.mon, BRIGHTNESS, 30)
+        writer.write(self.mon, DDC.VCP.CONTRAST.value, 60)
+        self.assertTrue(writer.join(5))
+        writer.close()
+        self.assertEqual(self.display.values[BRIGHTNESS][0], 30)
+        self.assertEqual(self.display.values[DDC.VCP.CONTRAST.value][0], 60)
+
+class TransitionEngineTest(SimTestCase):
+    def setUp(self):
+        super().setUp()
+        self.pool = IOPool()
+        self.engine = TransitionEngine(self.ddc, self.pool, min_frame=0.005)
+        self.written = []
+        write_vcp = self.ddc.write_vcp
+        def record(con, code, value):
+            self.written.append(value)
+            write_vcp(con, code, value)
+        self.ddc.write_vcp = record
+
+    def tearDown(self):
+        self.engine.close()
+        self.pool.shutdown()
+        super().tearDown()
+
+    def test_target_lands(self):
+        self.display.values[BRIGHTNESS][0] = 20
+        writes = self.engine.start(self.mon, BRIGHTNESS, 80, duration=0.1).result(5)
+        self.assertEqual(self.display.values[BRIGHTNESS][0], 80)
+        self.assertEqual(writes, len(self.written))
+        self.assertEqual(self.written[-1], 80)
+        # every write gets closer to the target
+        self.assertEqual(self.written, sorted(set(self.written)))
+        self.assertGreater(self.written[0], 20)
+
+    def test_unchanged_frames_skipped(self):
+        # far more frames than values in between, each value is written once
+        self.display.values[BRIGHTNESS][0] = 50
+        writes = self.engine.start(self.mon, BRIGHTNESS, 53, duration=0.2).result(5)
+        self.assertEqual(self.written, [51, 52, 53])
+        self.assertEqual(writes, 3)
+
+    def test_retarget(self):
+        self.display.values[BRIGHTNESS][0] = 50
+        first = self.engine.start(self.mon, BRIGHTNESS, 90, duration=0.2)
+        second = self.engine.start(self.mon, BRIGHTNESS, 10, duration=0.05)
+        self.assertIs(first, second)
+        second.result(5)
+        self.assertEqual(self.display.values[BRIGHTNESS][0], 10)
+        self.assertEqual(self.written[-1], 10)
+
+class WheelAccumulatorTest(unittest.TestCase):
+    def setUp(self):
+        self.mon = Monitor(display_idx=1, display_ref=1, model='', manufacturer='', vcp_ver='', bus=3)
+        self.value = VCP_result(value=50, max=100)
+        self.written = []
+
+    def accumulator(self, **kwargs):
+        return WheelAccumulator(lambda mon, value: self.written.append(value), lambda mon: self.value,
+            **kwargs)
+
+    def drain(self, acc):
+        while (wait := acc.flush()) is not None:
+            time.sleep(wait)
+
+    def test_last_value_written(self):
+        acc = self.accumulator(step=1, min_interval=0.02)
+        for _ in range(10):
+            acc.add(self.mon, 1)
+            acc.flush()
+        # the steps added while waiting for the display are not lost
+        self.drain(acc)
+        self.assertEqual(self.written[-1], 60)
+        self.assertLess(len(self.written), 10)
+
+    def test_paced_by_latency(self):
+        acc = self.accumulator(step=5, min_interval=0.01, latency=lambda mon: 0.05)
+        acc.add(self.mon, 1)
+        self.assertIsNone(acc.flush())
+        acc.add(self.mon, 1)
+        wait = acc.flush()
+        self.assertGreater(wait, 0.02)
+        self.assertEqual(self.written, [55])
+        self.drain(acc)
+        self.assertEqual(self.written, [55, 60])
+
+    def test_clamped(self):
+        acc = self.accumulator(step=5)
+        acc.add(self.mon, 20)
+        self.drain(acc)
+        self.assertEqual(self.written, [100])
+
+    def test_fractions(self):
+        # touchpads send fractions of a notch, they add up to whole steps
+        acc = self.accumulator(step=4, min_interval=0.01)
+        for _ in range(4):
+            acc.add(self.mon, 0.25)
+        self.drain(acc)
+        self.assertEqual(self.written, [54])
+
+if __name__ == '__main__':
+    unittest.main()